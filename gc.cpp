@@ -1,23 +1,30 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
 #include <list>
+#include <new>
+#include <string>
 #include "gc.h"
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
 gc_object::gc_object()
 {
     if (DEBUG)
         std::cout << "normal constructor" << std::endl;
-    prev = actual_obj;
-    actual_obj->next = this;
-    actual_obj = this;
 }
 
 gc_object::gc_object(const gc_object &)
 {
     if (DEBUG)
         std::cout << "copy constructor" << std::endl;
-    prev = actual_obj;
-    actual_obj->next = this;
-    actual_obj = this;
 }
 
 gc_object &gc_object::operator=(const gc_object &)
@@ -32,184 +39,2935 @@ gc_object::~gc_object()
 {
     if (DEBUG)
         std::cout << "let's call it done chaps! (~gc_object)" << std::endl;
-    if (actual_obj == this)
-        actual_obj = prev;
+}
+
+void gc_object::trace(gc::tracer &t)
+{
+    t.unbarriered = true;
+    get_ptrs([&t](gc_object *object)
+             { t(object); });
+}
+
+namespace
+{
+    // 8 bytes apart up to 64: with the vtable pointer as the only header, objects of one or two
+    // pointer fields would otherwise pay a third of their slot in padding (alignof is at most 8 for
+    // sizes that are not a multiple of 16, and slots stay at least a mark granule apart)
+    constexpr std::uint32_t class_sizes[] = {
+        16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+        2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192};
+    constexpr std::size_t max_small_size = 8192;
+
+    // size class for every multiple of 8 up to max_small_size
+    struct size_class_table
+    {
+        std::uint8_t index[max_small_size / 8 + 1];
+
+        constexpr size_class_table() : index()
+        {
+            std::uint32_t c = 0;
+            for (std::uint32_t g = 0; g <= max_small_size / 8; g++)
+            {
+                while (class_sizes[c] < g * 8)
+                    c++;
+                index[g] = static_cast<std::uint8_t>(c);
+            }
+        }
+    };
+    constexpr size_class_table size_classes;
+
+    // the heap growth policy does not collect heaps smaller than this
+    constexpr std::size_t min_collect_bytes = std::size_t(4) << 20;
+
+    // cpus the process may use: hardware_concurrency reports the host's cpus even when the affinity
+    // mask or a container's cpu quota (cgroup v2 cpu.max, v1 cfs_quota_us) allow far fewer
+    int usable_cpus()
+    {
+        int cpus = std::max(1u, std::thread::hardware_concurrency());
+#ifdef __linux__
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            cpus = std::max(1, CPU_COUNT(&set));
+
+        long quota = -1;
+        long period = 0;
+        std::ifstream cpu_max("/sys/fs/cgroup/cpu.max");
+        std::string limit;
+        if (cpu_max >> limit >> period)
+            quota = limit == "max" ? -1 : std::strtol(limit.c_str(), nullptr, 10);
+        else
+        {
+            std::ifstream cfs_quota("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+            std::ifstream cfs_period("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+            if (!(cfs_quota >> quota && cfs_period >> period))
+                quota = -1;
+        }
+        if (quota > 0 && period > 0)
+            cpus = std::min(cpus, std::max(1, int((quota + period - 1) / period)));
+#endif
+        return cpus;
+    }
+
+    void environment_overrides(gc::options &o)
+    {
+        if (const char *value = std::getenv("GC_THREADS"))
+            o.threads = std::max(0, int(std::strtol(value, nullptr, 10)));
+        if (const char *value = std::getenv("GC_SERIAL_THRESHOLD"))
+            o.serial_threshold = std::strtoull(value, nullptr, 10);
+        if (const char *value = std::getenv("GC_PROMOTION_AGE"))
+            o.promotion_age = int(std::strtol(value, nullptr, 10));
+        if (const char *value = std::getenv("GC_FINALIZER"))
+            o.finalizer = std::strtol(value, nullptr, 10) != 0;
+        if (const char *value = std::getenv("GC_PREFETCH"))
+            o.prefetch = int(std::strtol(value, nullptr, 10));
+        if (const char *value = std::getenv("GC_HEAP_GROWTH"))
+            o.heap_growth = std::max(0.0, std::strtod(value, nullptr));
+        if (const char *value = std::getenv("GC_COMPACT_THRESHOLD"))
+            o.compact_threshold = std::max(0.0, std::strtod(value, nullptr));
+        if (const char *value = std::getenv("GC_MARKING"))
+        {
+            if (!std::strcmp(value, "adaptive"))
+                o.marking = gc::marking_mode::adaptive;
+            else if (!std::strcmp(value, "serial"))
+                o.marking = gc::marking_mode::serial;
+            else if (!std::strcmp(value, "parallel"))
+                o.marking = gc::marking_mode::parallel;
+            else
+                std::cerr << "GC_MARKING: unknown marking mode " << value << std::endl;
+        }
+        if (const char *value = std::getenv("GC_SWEEP_MODE"))
+        {
+            if (!std::strcmp(value, "serial"))
+                o.sweep = gc::sweep_mode::serial;
+            else if (!std::strcmp(value, "parallel"))
+                o.sweep = gc::sweep_mode::parallel;
+            else if (!std::strcmp(value, "lazy"))
+                o.sweep = gc::sweep_mode::lazy;
+            else if (!std::strcmp(value, "concurrent"))
+                o.sweep = gc::sweep_mode::concurrent;
+            else
+                std::cerr << "GC_SWEEP_MODE: unknown sweep mode " << value << std::endl;
+        }
+    }
+}
 
-    // if prev/next are not null then keep the list valid
-    if (prev)
-        prev->next = next;
+struct gc::mutator
+{
+    gc_root_list *roots = new gc_root_list();
+    page *current[heap_count] = {};
+    gc_handle_table handles;
+    bool blocking = false;
+    // pages the thread allocated from since its last safepoint (the current ones stay), and whether it
+    // allocated since
+    std::vector<page *> fresh_pages;
+    bool fresh = false;
+};
 
+void gc_handle_table::grow()
+{
     if (next)
-        next->prev = prev;
+        chunk++;
+    if (chunk == chunks.size())
+        chunks.push_back(new gc_object *[chunk_size]);
+    next = chunks[chunk];
+    limit = next + chunk_size;
 }
 
-gc_object_base gc_object_base::head_obj;
-gc_object_base *gc_object_base::actual_obj = &head_obj;
+gc_handle_table::~gc_handle_table()
+{
+    for (gc_object **c : chunks)
+        delete[] c;
+}
 
-gc_root_ptr_base gc_root_ptr_base::head_root;
-gc_root_ptr_base *gc_root_ptr_base::actual_root = &head_root;
+namespace
+{
+    // unregisters the thread when it exits
+    struct mutator_exit
+    {
+        ~mutator_exit()
+        {
+            gc::unregister_thread();
+        }
+    };
+    thread_local mutator_exit exit_hook;
+}
 
-void gc::callback(gc_object *object)
+gc::mutator *gc::current_mutator()
 {
-    if (!object)
+    if (!self)
+        register_thread();
+    return self;
+}
+
+gc_root_list *gc::thread_roots()
+{
+    return current_mutator()->roots;
+}
+
+void gc::register_thread()
+{
+    if (self)
+        return;
+    (void)&exit_hook;
+
+    mutator *m = new mutator();
+    std::unique_lock<std::mutex> lock(world_mutex);
+    // a thread must not start using the heap while it is stopped
+    resume_condition.wait(lock, [&]()
+                          { return !world_stopped; });
+    mutators.push_back(m);
+    root_lists.push_back(m->roots);
+    self = m;
+    handle_table = &m->handles;
+}
+
+void gc::unregister_thread()
+{
+    mutator *m = self;
+    if (!m)
+        return;
+
+    std::unique_lock<std::mutex> lock(world_mutex);
+    park(lock);
+
+    // hand the thread's pages back before a collection can start without it
+    {
+        std::unique_lock<std::mutex> heap_lock(heap_mutex);
+        for (std::uint32_t size_class = 0; size_class < heap_count; size_class++)
+        {
+            page *p = m->current[size_class];
+            if (!p)
+                continue;
+            p->in_use = false;
+            m->current[size_class] = nullptr;
+            reclaim_finalized(p);
+            if (p->used < p->capacity && !p->needs_sweep)
+            {
+                p->next_available = heaps[size_class].available;
+                heaps[size_class].available = p;
+            }
+        }
+        m->fresh = true;
+        forget_fresh(m);
+    }
+
+    mutators.erase(std::find(mutators.begin(), mutators.end(), m));
+    if (m->blocking)
+        parked--;
+    self = nullptr;
+    handle_table = nullptr;
+
+    // roots the thread leaves behind (e.g. in objects of other threads) stay roots, an empty list goes
+    bool empty;
+    {
+        std::unique_lock<std::mutex> guard(m->roots->lock);
+        empty = !m->roots->head_root.next;
+        m->roots->orphaned = !empty;
+    }
+    if (empty)
+    {
+        root_lists.erase(std::find(root_lists.begin(), root_lists.end(), m->roots));
+        delete m->roots;
+    }
+    lock.unlock();
+    delete m;
+}
+
+// waits at the safepoint while another thread has the world stopped, world_mutex is held
+void gc::park(std::unique_lock<std::mutex> &lock)
+{
+    if (!world_stopped || world_owner == std::this_thread::get_id())
+        return;
+    parked++;
+    world_condition.notify_all();
+    resume_condition.wait(lock, [&]()
+                          { return !world_stopped; });
+    parked--;
+}
+
+void gc::park_here()
+{
+    if (!self)
         return;
-    
-    object->reachability_flag = true;
+    std::unique_lock<std::mutex> lock(world_mutex);
+    park(lock);
+}
 
-    // we don't need any complicated synchonization here (it doesn't really matter if we spawn another job even if race condition occures)
-    if (fork_counter > 0)
+void gc::stop_the_world()
+{
+    std::unique_lock<std::mutex> lock(world_mutex);
+    world_held++;
+    if (world_stopped && world_owner == std::this_thread::get_id())
     {
-        fork_counter -= 1;
-        job_counter += 1;
-        add_job(object);
+        world_depth++;
         return;
     }
-    object->get_ptrs(callback);
+    // another thread is collecting, stop here like at any safepoint first
+    while (world_stopped)
+    {
+        if (self)
+            park(lock);
+        else
+            resume_condition.wait(lock);
+    }
+
+    world_stopped = true;
+    world_owner = std::this_thread::get_id();
+    world_depth = 1;
+    safepoint_requested.store(true, std::memory_order_release);
+    world_condition.wait(lock, [&]()
+                         { return parked == int(mutators.size()) - (self ? 1 : 0); });
 }
-void gc::threadpool_loop()
+
+void gc::start_the_world()
 {
-    while (true)
+    world_held--;
     {
-        gc_object *job = nullptr;
+        std::unique_lock<std::mutex> lock(world_mutex);
+        if (--world_depth)
+            return;
+        world_stopped = false;
+        world_owner = std::thread::id();
+        safepoint_requested.store(false, std::memory_order_release);
+    }
+    resume_condition.notify_all();
+}
 
-        {
-            std::unique_lock<std::mutex> lock(threadpool_mutex);
+void gc::enter_blocking()
+{
+    mutator *m = current_mutator();
+    std::unique_lock<std::mutex> lock(world_mutex);
+    m->blocking = true;
+    parked++;
+    world_condition.notify_all();
+}
 
-            threadpool_condition.wait(lock, [&]()
-                                      { return !queue.empty() || terminate_pool; });
-            if (!queue.empty())
-            {
-                job = queue.front();
-                queue.pop();
-            }
+void gc::leave_blocking()
+{
+    mutator *m = current_mutator();
+    std::unique_lock<std::mutex> lock(world_mutex);
+    resume_condition.wait(lock, [&]()
+                          { return !world_stopped; });
+    m->blocking = false;
+    parked--;
+}
+
+void gc::forget_fresh()
+{
+    mutator *m = self;
+    if (!m || !m->fresh)
+        return;
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    forget_fresh(m);
+}
+
+// the thread's objects no longer need to survive on their own: a page it has moved on from is dropped
+// from its list, the bits go once no other thread lists the page, heap_mutex is held
+void gc::forget_fresh(mutator *m)
+{
+    auto clear = [](page *p)
+    {
+        for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+            p->fresh[w] = 0;
+    };
+    std::size_t kept = 0;
+    for (page *p : m->fresh_pages)
+    {
+        bool current = p->size_class != page::large_class && m->current[p->size_class] == p;
+        for (std::size_t i = 0; current && i < kept; i++)
+            current = m->fresh_pages[i] != p;
+        if (current)
+            m->fresh_pages[kept++] = p;
+        else if (!--p->fresh_holders)
+            clear(p);
+    }
+    m->fresh_pages.resize(kept);
+    // the owner's fast path sets the bits of a current page, nobody else
+    for (page *p : m->fresh_pages)
+    {
+        if (p->fresh_holders == 1)
+            clear(p);
+    }
+    m->fresh = false;
+}
+
+// the object starting at word if it is an allocated one that is not fresh itself, for scanning fresh
+// objects conservatively
+gc_object *gc::fresh_target(const void *word)
+{
+    page *p = page_map.find(word);
+    if (!p || word < p->first)
+        return nullptr;
+    std::uint32_t index = p->slot_index(word);
+    if (index >= p->bump || p->first + std::size_t(index) * p->object_size != word)
+        return nullptr;
+    if (!((p->allocated[index / 64] & ~p->fresh[index / 64]) >> (index % 64) & 1))
+        return nullptr;
+    return static_cast<gc_object *>(const_cast<void *>(word));
+}
+
+gc::page *gc::new_page(std::uint32_t size_class)
+{
+    static_assert(sizeof(class_sizes) / sizeof(class_sizes[0]) == size_class_count, "size_class_count is out of date");
+    void *memory = std::aligned_alloc(page::size, page::size);
+    if (!memory)
+        throw std::bad_alloc();
+
+    page *p = new (memory) page();
+    p->first = static_cast<char *>(memory) + page_header_size;
+    p->size_class = size_class;
+    p->object_size = class_sizes[size_class % size_class_count];
+    p->leaf = size_class >= size_class_count;
+    p->capacity = static_cast<std::uint32_t>((page::size - page_header_size) / p->object_size);
+    p->reciprocal = ((std::uint64_t(1) << 32) + p->object_size - 1) / p->object_size;
+    marks.ensure(memory);
+    page_map.set(p, p);
+    heap_bytes += page::size;
+
+    size_class_heap &heap = heaps[size_class];
+    if (heap.last)
+        heap.last->next = p;
+    else
+        heap.pages = p;
+    heap.last = p;
+    return p;
+}
+
+void *gc::allocate(std::size_t size)
+{
+    if (size > max_small_size)
+        return allocate_large(size, false);
+    return allocate_small(self ? self : current_mutator(), size_classes.index[(size + 7) / 8]);
+}
+
+void *gc::allocate_leaf(std::size_t size)
+{
+    if (size > max_small_size)
+        return allocate_large(size, true);
+    return allocate_small(self ? self : current_mutator(), size_class_count + size_classes.index[(size + 7) / 8]);
+}
+
+// size_class indexes heaps, i.e. leaf classes come after the others
+void *gc::allocate_small(mutator *m, std::uint32_t size_class)
+{
+    page *p = m->current[size_class];
+    if (p)
+    {
+        void *slot = p->free_list;
+        std::uint32_t index;
+        if (slot)
+        {
+            p->free_list = *static_cast<void **>(slot);
+            index = p->slot_index(slot);
         }
-        if (job != nullptr)
+        else if (p->bump < p->capacity)
         {
-            job->get_ptrs(callback);
+            index = p->bump++;
+            slot = p->first + std::size_t(index) * p->object_size;
+        }
+        else
+            return allocate_slow(m, size_class);
 
-            // notify other threads that one thread has just finished (to spawn new job)
-            fork_counter += 1;
+        p->allocated[index / 64] |= std::uint64_t(1) << (index % 64);
+        p->fresh[index / 64] |= std::uint64_t(1) << (index % 64);
+        p->used++;
+        m->fresh = true;
+        if (marking_active.load(std::memory_order_relaxed))
+        {
+            marks.try_mark(slot);
+            // it will not be traced this cycle, so it is not known whether it has raw pointer fields
+            if (generational)
+                remember_object(slot);
+        }
+        return slot;
+    }
+    return allocate_slow(m, size_class);
+}
 
-            thread_finish_counter += 1;
+void *gc::allocate_slow(mutator *m, std::uint32_t size_class)
+{
+    // not safepoint(): the caller may be a constructor, what it allocated so far has to stay
+    if (safepoint_requested.load(std::memory_order_acquire))
+        park_here();
+    maybe_collect();
 
-            // if number of finished jobs equals job counter, then wake up the main thread
-            if (thread_finish_counter == job_counter)
-                end_of_marking_condition.notify_one();
+    // the thread's page is full, continue with a page a sweep freed slots in,
+    // sweep a page the last collection left behind or take a fresh one
+    size_class_heap &heap = heaps[size_class];
+    page *&current = m->current[size_class];
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    if (current)
+    {
+        // a collection at the safepoint (or the finalizer thread) may have freed slots in it
+        reclaim_finalized(current);
+        if (current->free_list || current->bump < current->capacity)
+        {
+            lock.unlock();
+            return allocate_small(m, size_class);
         }
-        else
+        current->in_use = false;
+        current = nullptr;
+    }
+    while (!current)
+    {
+        page *p = nullptr;
+        bool unswept = false;
+        if (heap.available)
+        {
+            p = heap.available;
+            heap.available = p->next_available;
+        }
+        else if (heap.unswept)
+        {
+            p = heap.unswept;
+            heap.unswept = p->next_unswept;
+            unswept_pages--;
+            unswept = true;
+            p->claimed = true;
+        }
+        if (!p)
+        {
+            current = new_page(size_class);
             break;
+        }
+
+        // destructors run outside the lock
+        if (unswept)
+        {
+            lock.unlock();
+            sweep_page(p);
+            lock.lock();
+            p->claimed = false;
+            sweep_done_condition.notify_all();
+        }
+        if (p->used < p->capacity)
+            current = p;
     }
+    current->in_use = true;
+    m->fresh_pages.push_back(current);
+    current->fresh_holders++;
+    if (generational)
+        enter_nursery(current);
+    lock.unlock();
+    return allocate_small(m, size_class);
 }
 
-void gc::add_job(gc_object *New_Job)
+// a leaf object starts 16 bytes before a 4 KiB boundary, so the bytes of a gc_bytes are page-aligned
+void *gc::allocate_large(std::size_t size, bool leaf)
 {
+    constexpr std::size_t io_alignment = 4096;
+    constexpr std::size_t leaf_header = 16;
+    constexpr std::size_t leaf_offset = ((page_header_size + leaf_header + io_alignment - 1) & ~(io_alignment - 1)) - leaf_header;
+    static_assert(tracer::array_chunk * sizeof(void *) >= max_small_size, "a chunked gc_array must have a large page of its own");
+
+    mutator *m = self ? self : current_mutator();
+    maybe_collect();
+    if (sweeping == sweep_mode::lazy)
+        sweep_large();
+
+    std::size_t offset = leaf ? leaf_offset : page_header_size;
+    std::size_t bytes = (offset + size + page::size - 1) & ~(page::size - 1);
+    void *memory = map_large(bytes);
+
+    page *p = new (memory) page();
+    p->first = static_cast<char *>(memory) + offset;
+    p->leaf = leaf;
+    p->size_class = page::large_class;
+    p->object_size = static_cast<std::uint32_t>(std::min<std::size_t>(size, UINT32_MAX));
+    p->capacity = 1;
+    p->used = 1;
+    p->bump = 1;
+    p->allocated[0] = 1;
+    p->fresh[0] = 1;
+    p->span = bytes;
+
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    m->fresh_pages.push_back(p);
+    p->fresh_holders = 1;
+    m->fresh = true;
+    marks.ensure(memory);
+    page_map.set(p, p);
+    heap_bytes += bytes;
+    if (marking_active.load(std::memory_order_relaxed))
     {
-        std::unique_lock<std::mutex> lock(add_job_mutex);
-        queue.push(New_Job);
+        marks.try_mark(p->first);
+        if (generational)
+            remember_object(p->first);
     }
-    threadpool_condition.notify_one();
+    if (generational)
+        enter_nursery(p);
+    p->next = large_pages;
+    large_pages = p;
+    return p->first;
 }
 
-void gc::terminate_threads()
+// large pages are mapped one by one and unmapped as soon as their object dies, so a big buffer goes straight
+// back to the OS instead of staying in the malloc heap
+void *gc::map_large(std::size_t bytes)
+{
+#ifdef __linux__
+    // mmap only aligns to the OS page, map a page::size more and unmap the ends around the aligned block
+    void *mapped = mmap(nullptr, bytes + page::size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+        throw std::bad_alloc();
+    std::uintptr_t start = reinterpret_cast<std::uintptr_t>(mapped);
+    std::uintptr_t aligned = (start + page::size - 1) & ~(std::uintptr_t(page::size) - 1);
+    if (aligned != start)
+        munmap(mapped, aligned - start);
+    if (aligned + bytes != start + bytes + page::size)
+        munmap(reinterpret_cast<void *>(aligned + bytes), start + page::size - aligned);
+    return reinterpret_cast<void *>(aligned);
+#else
+    void *memory = std::aligned_alloc(page::size, bytes);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+#endif
+}
+
+void gc::unmap_large(page *p)
+{
+#ifdef __linux__
+    munmap(p, p->span);
+#else
+    std::free(p);
+#endif
+}
+
+void gc::deallocate(void *object)
 {
+    page *p = page::of(object);
+    if (p->size_class == page::large_class)
     {
-        std::unique_lock<std::mutex> lock(shutdown_mutex);
-        terminate_pool = true;
+        // the thread that allocated the object may still list its page as fresh
+        std::unique_lock<std::mutex> world_lock(world_mutex);
+        std::unique_lock<std::mutex> lock(heap_mutex);
+        // a dead object deleted by the destructor of another (as for small objects below), sweep_large()
+        // frees it
+        if (!p->allocated[0] || (p->needs_sweep && !marks.is_marked(p->first)))
+        {
+            p->trivial[0] = 1;
+            return;
+        }
+        // a pending sweep_large() only looks at the pages still listed, the mark goes with the page
+        if (p->needs_sweep)
+            marks.clear(p);
+        for (mutator *m : mutators)
+        {
+            if (!p->fresh_holders)
+                break;
+            auto listed = std::find(m->fresh_pages.begin(), m->fresh_pages.end(), p);
+            if (listed == m->fresh_pages.end())
+                continue;
+            m->fresh_pages.erase(listed);
+            p->fresh_holders--;
+        }
+        forget_page(p);
+        page_map.set(p, nullptr);
+        heap_bytes -= p->span;
+        page **link = &large_pages;
+        while (*link != p)
+            link = &(*link)->next;
+        *link = p->next;
+        unmap_large(p);
+        return;
     }
 
-    threadpool_condition.notify_all();
-    for (std::thread &every_thread : pool)
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    std::uint32_t index = p->slot_index(object);
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    // a destructor run by a sweep deleted another dead object, whose destructor has run by now: the sweep
+    // that found it dead (the one going on or a pending one) frees the slot without destroying it again
+    bool dead = p == sweeping_here ? !(p->allocated[index / 64] & bit)
+                                   : p->needs_sweep && !p->claimed && !marks.is_marked(object);
+    if (dead)
     {
-        every_thread.join();
+        p->trivial[index / 64] |= bit;
+        return;
     }
+    // the page may still be waiting for (or going through) a lazy or concurrent sweep, which would
+    // otherwise keep the slot or hand it out twice
+    if (p->claimed || p->needs_sweep)
+        sweep_now(p, lock);
+    __atomic_fetch_and(&p->remembered[index / 64], ~bit, __ATOMIC_RELAXED);
+    if (p->in_use && (!self || p != self->current[p->size_class]))
+    {
+        // another thread allocates from the page without locking, leave a placeholder the next sweep frees
+        new (object) gc_object_base();
+        return;
+    }
+    p->allocated[index / 64] &= ~bit;
+    p->fresh[index / 64] &= ~bit;
+    p->trivial[index / 64] &= ~bit;
+    p->relocatable[index / 64] &= ~bit;
+    p->old[index / 64] &= ~bit;
+    p->age_low[index / 64] &= ~bit;
+    p->age_high[index / 64] &= ~bit;
+    p->used--;
+    *static_cast<void **>(object) = p->free_list;
+    p->free_list = object;
+}
 
-    pool.clear();
-    stopped = true;
+// destroys every allocated but unmarked object of a small page, walking the slots in address order,
+// or leaves the ones with a destructor to run in deferred (unlinked but still counted in used)
+// touches nothing outside the page, so different pages can be swept concurrently
+std::size_t gc::sweep_page(page *p, std::vector<void *> *deferred)
+{
+    std::size_t freed = 0;
+    bool lazy = p->needs_sweep;
+    page *outer = sweeping_here;
+    sweeping_here = p;
+
+    // nothing in the page survived and no destructor has to run (dead leaf pages, mostly): every
+    // slot is free again at once
+    bool plain = !p->finalized && !marks.any(p);
+    for (std::uint32_t w = 0; plain && w * 64 < p->bump; w++)
+        plain = !(p->allocated[w] & ~p->trivial[w]);
+    if (plain && p->used)
+    {
+        freed = p->used;
+        // bump drops to 0, so the generational bits are cleared here, the loop below no longer reaches them
+        for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+        {
+            p->allocated[w] = 0;
+            p->trivial[w] = 0;
+            p->relocatable[w] = 0;
+            p->old[w] = 0;
+            p->age_low[w] = 0;
+            p->age_high[w] = 0;
+            p->remembered[w] = 0;
+        }
+        p->used = 0;
+        p->bump = 0;
+        p->free_list = nullptr;
+    }
+
+    // every dead slot is unlinked before the first destructor runs: one that deletes another dead object
+    // of the page finds it unallocated, and deallocate() leaves it to this loop (see below)
+    std::uint64_t dead[page::size / 16 / 64] = {};
+    for (std::uint32_t w = 0; !plain && w * 64 < p->bump; w++)
+    {
+        std::uint64_t bits = p->allocated[w];
+        while (bits)
+        {
+            std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+            std::uint64_t bit = bits & -bits;
+            bits &= bits - 1;
+            if (!marks.is_marked(p->first + std::size_t(index) * p->object_size))
+                dead[w] |= bit;
+        }
+        p->allocated[w] &= ~dead[w];
+        p->relocatable[w] &= ~dead[w];
+        freed += __builtin_popcountll(dead[w]);
+    }
+    for (std::uint32_t w = 0; !plain && w * 64 < p->bump; w++)
+    {
+        while (dead[w])
+        {
+            std::uint32_t index = w * 64 + __builtin_ctzll(dead[w]);
+            std::uint64_t bit = dead[w] & -dead[w];
+            dead[w] &= dead[w] - 1;
+
+            // read again for every slot, deallocate() sets the bit of an object deleted meanwhile
+            bool trivial = p->trivial[w] & bit;
+            p->trivial[w] &= ~bit;
+            char *slot = p->first + std::size_t(index) * p->object_size;
+            if (!trivial)
+            {
+                if (deferred)
+                {
+                    deferred->push_back(slot);
+                    continue;
+                }
+                if (DEBUG)
+                    std::cout << "Delete!" << std::endl;
+                reinterpret_cast<gc_object_base *>(slot)->~gc_object_base();
+            }
+            p->used--;
+            *reinterpret_cast<void **>(slot) = p->free_list;
+            p->free_list = slot;
+        }
+    }
+
+    // the rest of the heap keeps its marks until it is swept
+    if (lazy)
+    {
+        marks.clear(p);
+        p->needs_sweep = false;
+    }
+
+    // every survivor of a full collection is old
+    if (generational)
+    {
+        for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+        {
+            p->old[w] = p->allocated[w];
+            p->age_low[w] = 0;
+            p->age_high[w] = 0;
+            p->remembered[w] &= p->allocated[w];
+        }
+    }
+    sweeping_here = outer;
+    return freed;
 }
-void gc::start_threadpool()
+
+void gc::sweep_loop()
 {
-    hw_threads = std::thread::hardware_concurrency();
-    for (int i = 0; i < hw_threads; i++)
+    constexpr std::size_t chunk = 16;
+    std::size_t freed = 0;
+    std::vector<void *> deferred;
+    while (true)
     {
-        pool.push_back(std::thread(threadpool_loop));
+        std::size_t begin = next_sweep_page.fetch_add(chunk);
+        if (begin >= sweep_pages.size())
+            break;
+        std::size_t end = std::min(begin + chunk, sweep_pages.size());
+        for (std::size_t i = begin; i < end; i++)
+            freed += sweep_page(sweep_pages[i], config.finalizer ? &deferred : nullptr);
+    }
+    swept_objects += freed;
+    if (!deferred.empty())
+    {
+        std::unique_lock<std::mutex> lock(finalizer_mutex);
+        dead_objects.insert(dead_objects.end(), deferred.begin(), deferred.end());
     }
-    terminate_pool = false;
-    stopped = false;
 }
 
-void gc::collect()
+// returns the number of objects freed
+std::size_t gc::sweep()
 {
-    if (stopped)
+    std::size_t freed = 0;
+    if (sweeping == sweep_mode::parallel && !stopped)
     {
-        start_threadpool();
+        for (size_class_heap &heap : heaps)
+        {
+            for (page *p = heap.pages; p; p = p->next)
+                sweep_pages.push_back(p);
+        }
+        next_sweep_page = 0;
+        swept_objects = 0;
+        run_pool(pool_task::sweep);
+        freed = swept_objects;
+        sweep_pages.clear();
     }
-    auto mark_iterator = gc_root_ptr_base::head_root.next;
-    fork_counter = hw_threads;
-    thread_finish_counter = 0;
-    job_counter = 0;
-    while (mark_iterator)
+    else
     {
-        if (mark_iterator->gc_object_pointer)
+        for (size_class_heap &heap : heaps)
         {
-            mark_iterator->gc_object_pointer->reachability_flag = true;
+            for (page *p = heap.pages; p; p = p->next)
+                freed += sweep_page(p, config.finalizer ? &dead_objects : nullptr);
+        }
+    }
+    release_empty_pages();
 
-            // check if we are at the end gc_root_ptr list
-            //if(mark_iterator->next)
+    for (page *p = large_pages; p; p = p->next)
+        p->needs_sweep = true;
+    large_sweep_pending = true;
+    return freed + sweep_large(config.finalizer ? &dead_objects : nullptr);
+}
+
+// fixes up the page lists after sweeping: releases empty pages, collects the ones with free slots
+// returns the number of objects left in small pages
+std::size_t gc::release_empty_pages()
+{
+    std::size_t live = 0;
+    for (size_class_heap &heap : heaps)
+    {
+        heap.available = nullptr;
+        page **link = &heap.pages;
+        page *last = nullptr;
+        while (page *p = *link)
+        {
+            if (!p->used && !p->in_use && !p->fresh_holders)
+            {
+                // empty pages go back to the system
+                *link = p->next;
+                page_map.set(p, nullptr);
+                heap_bytes -= p->span;
+                std::free(p);
+                continue;
+            }
+            live += p->used;
+            if (!p->in_use && p->used < p->capacity)
             {
-                add_job(mark_iterator->gc_object_pointer);
-                job_counter++;
+                p->next_available = heap.available;
+                heap.available = p;
             }
+            last = p;
+            link = &p->next;
         }
-        mark_iterator = mark_iterator->next;
+        heap.last = last;
     }
+    return live;
+}
 
+// sweeps the large objects flagged by the last collection, later ones are unmarked but alive
+// the dead ones with a destructor to run go to deferred instead if given
+std::size_t gc::sweep_large(std::vector<void *> *deferred)
+{
+    // unlink the dead ones under the lock, destroy them outside of it
+    page *dead = nullptr;
     {
-        std::unique_lock<std::mutex> myLock(wait_mutex);
+        std::unique_lock<std::mutex> lock(heap_mutex);
+        if (!large_sweep_pending)
+            return 0;
+        large_sweep_pending = false;
 
-        end_of_marking_condition.wait(myLock, [&]()
-                                      { return thread_finish_counter == job_counter; });
+        page **link = &large_pages;
+        while (page *p = *link)
+        {
+            if (!p->needs_sweep || marks.is_marked(p->first))
+            {
+                if (p->needs_sweep)
+                {
+                    marks.clear(p);
+                    p->needs_sweep = false;
+                    if (generational)
+                    {
+                        p->old[0] = 1;
+                        p->age_low[0] = 0;
+                        p->age_high[0] = 0;
+                    }
+                }
+                link = &p->next;
+                continue;
+            }
+            *link = p->next;
+            p->next = dead;
+            dead = p;
+            // a destructor deleting the object now only sets trivial (see deallocate)
+            p->allocated[0] = 0;
+        }
     }
-    // sweeping
-    gc_object_base *sweep_iterator = gc_object_base::head_obj.next;
-    while (sweep_iterator)
+
+    std::size_t freed = 0;
+    while (dead)
     {
-        if (DEBUG)
-            std::cout << "Sweep it boys" << std::endl;
-        if (!(sweep_iterator->reachability_flag))
+        page *p = dead;
+        dead = p->next;
+        if (!p->trivial[0])
         {
-            gc_object_base *old_it = sweep_iterator;
-            sweep_iterator = sweep_iterator->next;
+            if (deferred)
+            {
+                deferred->push_back(p->first);
+                freed++;
+                continue;
+            }
             if (DEBUG)
                 std::cout << "Delete!" << std::endl;
-            delete old_it;
+            reinterpret_cast<gc_object_base *>(p->first)->~gc_object_base();
+        }
+        marks.clear(p);
+        page_map.set(p, nullptr);
+        heap_bytes -= p->span;
+        unmap_large(p);
+        freed++;
+    }
+    return freed;
+}
 
-            if (DEBUG)
-                std::cout << "No segFault?" << std::endl;
+// lazy and concurrent sweeping: hands every page over unswept, marks stay until a page is swept
+// the mutators are stopped, they give up their pages and get swept ones in the allocation slow path
+void gc::defer_sweep()
+{
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    for (mutator *m : mutators)
+    {
+        for (page *&p : m->current)
+        {
+            if (p)
+                p->in_use = false;
+            p = nullptr;
         }
-        else
+    }
+    for (size_class_heap &heap : heaps)
+    {
+        heap.available = nullptr;
+        heap.unswept = nullptr;
+        page **tail = &heap.unswept;
+        for (page *p = heap.pages; p; p = p->next)
         {
-            sweep_iterator->reachability_flag = false;
-            sweep_iterator = sweep_iterator->next;
+            p->needs_sweep = true;
+            *tail = p;
+            tail = &p->next_unswept;
+            unswept_pages++;
         }
+        *tail = nullptr;
     }
-    if (gc_object_base::actual_obj == &(gc_object_base::head_obj))
-        terminate_threads();
+    for (page *p = large_pages; p; p = p->next)
+        p->needs_sweep = true;
+    sweep_pending = true;
+    large_sweep_pending = true;
 }
-std::condition_variable gc::threadpool_condition;
-std::condition_variable gc::end_of_marking_condition;
 
-std::mutex gc::shutdown_mutex;
-std::mutex gc::add_job_mutex;
-std::mutex gc::wait_mutex;
-std::mutex gc::threadpool_mutex;
+// takes the next unswept page of any size class, heap_mutex must be held
+gc::page *gc::claim_unswept()
+{
+    for (int i = 0; i < heap_count; i++)
+    {
+        size_class_heap &heap = heaps[(next_unswept_class + i) % heap_count];
+        if (heap.unswept)
+        {
+            page *p = heap.unswept;
+            heap.unswept = p->next_unswept;
+            unswept_pages--;
+            sweeps_in_flight++;
+            p->claimed = true;
+            next_unswept_class = (next_unswept_class + i) % heap_count;
+            return p;
+        }
+    }
+    return nullptr;
+}
 
-std::queue<gc_object *> gc::queue;
-std::vector<std::thread> gc::pool;
+// deallocate() on a page a lazy or concurrent sweep has not finished, heap_mutex held: sweeps the
+// page on the calling thread if it is still on the unswept list, waits for whoever claimed it otherwise
+void gc::sweep_now(page *p, std::unique_lock<std::mutex> &lock)
+{
+    if (p->claimed)
+    {
+        if (p == sweeping_here)
+            return;
+        sweep_done_condition.wait(lock, [&]()
+                                  { return !p->claimed; });
+        return;
+    }
+    size_class_heap &heap = heaps[p->size_class];
+    page **link = &heap.unswept;
+    while (*link != p)
+        link = &(*link)->next_unswept;
+    *link = p->next_unswept;
+    unswept_pages--;
+    sweeps_in_flight++;
+    p->claimed = true;
+    lock.unlock();
+    sweep_page(p);
+    lock.lock();
 
-bool gc::terminate_pool = false;
-bool gc::stopped = true;
-int gc::hw_threads;
+    if (p->used < p->capacity)
+    {
+        p->next_available = heap.available;
+        heap.available = p;
+    }
+    p->claimed = false;
+    sweeps_in_flight--;
+    sweep_done_condition.notify_all();
+}
+
+// the background sweeper: sweeps pages handed over by collect() while the mutator keeps running
+void gc::sweeper_loop()
+{
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    while (true)
+    {
+        sweeper_condition.wait(lock, [&]()
+                               { return unswept_pages || large_sweep_pending || sweeper_stop; });
+        if (page *p = claim_unswept())
+        {
+            lock.unlock();
+            sweep_page(p);
+            lock.lock();
+
+            // publish the slots for the allocator
+            size_class_heap &heap = heaps[p->size_class];
+            if (p->used < p->capacity)
+            {
+                p->next_available = heap.available;
+                heap.available = p;
+            }
+            p->claimed = false;
+            sweeps_in_flight--;
+        }
+        else if (large_sweep_pending)
+        {
+            lock.unlock();
+            sweep_large();
+            lock.lock();
+        }
+        else if (sweeper_stop)
+            break;
+
+        // finish_sweep() waits for every page, sweep_now() for the one it needs
+        sweep_done_condition.notify_all();
+    }
+}
+
+void gc::stop_sweeper()
+{
+    if (!sweeper.joinable())
+        return;
+    {
+        std::unique_lock<std::mutex> lock(heap_mutex);
+        sweeper_stop = true;
+    }
+    sweeper_condition.notify_one();
+    sweeper.join();
+    sweeper_stop = false;
+}
+
+// hands the objects the pause left in dead_objects to the finalizer thread, at the end of the pause
+// (returning their slots touches the pages the sweep works on)
+void gc::start_finalizer()
+{
+    last_stats.finalized_objects = dead_objects.size();
+    if (dead_objects.empty())
+        return;
+    std::unique_lock<std::mutex> lock(finalizer_mutex);
+    if (finalizer_queue.empty())
+        finalizer_queue.swap(dead_objects);
+    else
+    {
+        finalizer_queue.insert(finalizer_queue.end(), dead_objects.begin(), dead_objects.end());
+        dead_objects.clear();
+    }
+    if (!finalizer.joinable())
+        finalizer = std::thread(finalizer_loop);
+    finalizer_condition.notify_one();
+}
+
+void gc::finalizer_loop()
+{
+    constexpr std::size_t batch_size = 4096;
+
+    std::vector<void *> batch;
+    std::unique_lock<std::mutex> lock(finalizer_mutex);
+    while (true)
+    {
+        finalizer_condition.wait(lock, [&]()
+                                 { return !finalizer_queue.empty() || finalizer_stop; });
+        if (finalizer_queue.empty())
+            break;
+
+        std::size_t first = finalizer_queue.size() > batch_size ? finalizer_queue.size() - batch_size : 0;
+        batch.assign(finalizer_queue.begin() + first, finalizer_queue.end());
+        finalizer_queue.resize(first);
+        finalizer_busy = true;
+        lock.unlock();
+
+        for (void *object : batch)
+        {
+            if (DEBUG)
+                std::cout << "Delete!" << std::endl;
+            static_cast<gc_object_base *>(object)->~gc_object_base();
+        }
+        release_finalized(batch);
+
+        lock.lock();
+        finalizer_busy = false;
+        if (finalizer_queue.empty())
+            finalized_condition.notify_all();
+    }
+}
+
+// gives destroyed objects their memory back: large pages are freed, slots go to the free list of their
+// page, or wait on the page while a mutator allocates from it
+void gc::release_finalized(const std::vector<void *> &slots)
+{
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    for (void *slot : slots)
+    {
+        page *p = page::of(slot);
+        if (p->size_class == page::large_class)
+        {
+            marks.clear(p);
+            page_map.set(p, nullptr);
+            heap_bytes -= p->span;
+            unmap_large(p);
+            continue;
+        }
+        if (p->in_use)
+        {
+            *static_cast<void **>(slot) = p->finalized;
+            p->finalized = slot;
+            p->finalized_count++;
+            continue;
+        }
+        // a page without free slots is not on the available list, one with free slots already is
+        if (p->used == p->capacity)
+        {
+            p->next_available = heaps[p->size_class].available;
+            heaps[p->size_class].available = p;
+        }
+        *static_cast<void **>(slot) = p->free_list;
+        p->free_list = slot;
+        p->used--;
+    }
+}
+
+// moves the slots the finalizer left on a page to its free list, by the page's owner or once nobody
+// allocates from it, with heap_mutex held
+void gc::reclaim_finalized(page *p)
+{
+    while (void *slot = p->finalized)
+    {
+        p->finalized = *static_cast<void **>(slot);
+        *static_cast<void **>(slot) = p->free_list;
+        p->free_list = slot;
+    }
+    p->used -= p->finalized_count;
+    p->finalized_count = 0;
+}
+
+// the next cycle must not mark or sweep while destructors still run, they may clear gc_member_ptrs
+void gc::wait_finalizer()
+{
+    std::unique_lock<std::mutex> lock(finalizer_mutex);
+    if (!finalizer.joinable() || std::this_thread::get_id() == finalizer.get_id())
+        return;
+    finalized_condition.wait(lock, [&]()
+                             { return finalizer_queue.empty() && !finalizer_busy; });
+}
+
+void gc::stop_finalizer()
+{
+    if (!finalizer.joinable())
+        return;
+    {
+        std::unique_lock<std::mutex> lock(finalizer_mutex);
+        finalizer_stop = true;
+    }
+    finalizer_condition.notify_one();
+    finalizer.join();
+    finalizer_stop = false;
+}
+
+void gc::finish_sweep()
+{
+    wait_finalizer();
+    if (!sweep_pending)
+        return;
+    stopped_world world;
+
+    // help the background sweeper (if any) with the remaining pages, then wait for the ones it holds
+    std::size_t freed = 0;
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    while (page *p = claim_unswept())
+    {
+        lock.unlock();
+        freed += sweep_page(p);
+        lock.lock();
+        p->claimed = false;
+        sweeps_in_flight--;
+    }
+    sweep_done_condition.wait(lock, [&]()
+                              { return !sweeps_in_flight; });
+    lock.unlock();
+
+    freed += sweep_large();
+    release_empty_pages();
+    sweep_pending = false;
+    if (DEBUG)
+        std::cout << "finish_sweep freed " << freed << std::endl;
+}
+
+// sets the remembered bit of an object, markers may do so concurrently during a full collection
+void gc::remember_object(const void *object)
+{
+    page *p = page::of(object);
+    std::uint32_t index = p->slot_index(object);
+    __atomic_fetch_or(&p->remembered[index / 64], std::uint64_t(1) << (index % 64), __ATOMIC_RELAXED);
+}
+
+// generational barrier, value was stored into field: an old object holding a young one is remembered
+void gc::remember(const void *field, gc_object *value)
+{
+    if (is_old(value))
+        return;
+
+    const void *object = value;
+    if (page *owner = page_map.find(field))
+    {
+        std::uint32_t index = owner->slot_index(field);
+        if (!((owner->old[index / 64] >> (index % 64)) & 1))
+            return;
+        object = owner->first + std::size_t(index) * owner->object_size;
+    }
+    // otherwise the field has no owner to rescan, the young object itself is remembered as a root
+
+    remember_object(object);
+    page *p = page::of(object);
+    std::unique_lock<std::mutex> lock(heap_mutex);
+    if (!p->in_remembered)
+    {
+        p->in_remembered = true;
+        remembered_pages.push_back(p);
+    }
+}
+
+void gc::enter_nursery(page *p)
+{
+    if (p->in_nursery)
+        return;
+    p->in_nursery = true;
+    nursery_pages.push_back(p);
+}
+
+// drops a large page that is about to be freed from the generational page lists
+void gc::forget_page(page *p)
+{
+    if (p->in_nursery)
+        nursery_pages.erase(std::find(nursery_pages.begin(), nursery_pages.end(), p));
+    if (p->in_remembered)
+        remembered_pages.erase(std::find(remembered_pages.begin(), remembered_pages.end(), p));
+}
+
+// counts one more survived minor collection for the survivors among the young slots of word w,
+// promotes the ones that reached promotion_age (they may point to young objects, so they are remembered)
+// returns the slots that stay young
+std::uint64_t gc::age_survivors(page *p, std::uint32_t w, std::uint64_t young, std::uint64_t survivors, std::size_t &promoted)
+{
+    int last = promotion_age - 1;
+    std::uint64_t low = p->age_low[w];
+    std::uint64_t high = p->age_high[w];
+    std::uint64_t due = survivors & (last & 1 ? low : ~low) & (last & 2 ? high : ~high);
+    std::uint64_t stay = survivors & ~due;
+
+    // the dead and the promoted start over from 0
+    low &= ~(young & ~stay);
+    high &= ~(young & ~stay);
+    high ^= low & stay;
+    low ^= stay;
+    p->age_low[w] = low;
+    p->age_high[w] = high;
+
+    if (due)
+    {
+        p->old[w] |= due;
+        p->remembered[w] |= due;
+        if (!p->in_remembered)
+        {
+            p->in_remembered = true;
+            remembered_pages.push_back(p);
+        }
+        promoted += __builtin_popcountll(due);
+    }
+    return stay;
+}
+
+// minor sweep of a nursery page: destroys the unmarked young objects and ages the rest,
+// returns false once the page holds no young objects (it has left the nursery, or was freed)
+bool gc::sweep_young(page *p, std::size_t &freed, std::size_t &promoted, std::vector<void *> *deferred)
+{
+    if (p->size_class == page::large_class)
+    {
+        if (!p->old[0] && !marks.is_marked(p->first))
+        {
+            {
+                std::unique_lock<std::mutex> lock(heap_mutex);
+                page **link = &large_pages;
+                while (*link != p)
+                    link = &(*link)->next;
+                *link = p->next;
+            }
+            freed++;
+            if (!p->trivial[0])
+            {
+                if (deferred)
+                {
+                    deferred->push_back(p->first);
+                    return false;
+                }
+                if (DEBUG)
+                    std::cout << "Delete!" << std::endl;
+                reinterpret_cast<gc_object_base *>(p->first)->~gc_object_base();
+            }
+            marks.clear(p);
+            page_map.set(p, nullptr);
+            heap_bytes -= p->span;
+            unmap_large(p);
+            return false;
+        }
+        marks.clear(p);
+        if (!p->old[0] && age_survivors(p, 0, 1, 1, promoted))
+            return true;
+        p->in_nursery = false;
+        return false;
+    }
+
+    // as in sweep_page, the dead are unlinked before the first destructor runs
+    page *outer = sweeping_here;
+    sweeping_here = p;
+    std::uint64_t dead[page::size / 16 / 64] = {};
+    std::uint64_t young_left = 0;
+    for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+    {
+        std::uint64_t young = p->allocated[w] & ~p->old[w];
+        std::uint64_t survivors = 0;
+        std::uint64_t bits = young;
+        while (bits)
+        {
+            std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+            std::uint64_t bit = bits & -bits;
+            bits &= bits - 1;
+            if (marks.is_marked(p->first + std::size_t(index) * p->object_size))
+                survivors |= bit;
+            else
+                dead[w] |= bit;
+        }
+        p->allocated[w] &= ~dead[w];
+        p->relocatable[w] &= ~dead[w];
+        freed += __builtin_popcountll(dead[w]);
+        if (young)
+            young_left |= age_survivors(p, w, young, survivors, promoted);
+    }
+    for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+    {
+        while (dead[w])
+        {
+            std::uint32_t index = w * 64 + __builtin_ctzll(dead[w]);
+            std::uint64_t bit = dead[w] & -dead[w];
+            dead[w] &= dead[w] - 1;
+
+            char *slot = p->first + std::size_t(index) * p->object_size;
+            if (p->trivial[w] & bit)
+                p->trivial[w] &= ~bit;
+            else if (deferred)
+            {
+                deferred->push_back(slot);
+                continue;
+            }
+            else
+            {
+                if (DEBUG)
+                    std::cout << "Delete!" << std::endl;
+                reinterpret_cast<gc_object_base *>(slot)->~gc_object_base();
+            }
+            p->used--;
+            *reinterpret_cast<void **>(slot) = p->free_list;
+            p->free_list = slot;
+        }
+    }
+    sweeping_here = outer;
+    marks.clear(p);
+
+    // a page allocated from keeps getting young objects
+    if (young_left || p->in_use)
+        return true;
+    p->in_nursery = false;
+    return false;
+}
+
+// after a full collection: nothing is young any more except what the pages in use will allocate,
+// the remembered set is what the barrier and the markers recorded (see note_unbarriered)
+void gc::reset_generations()
+{
+    nursery_pages.clear();
+    remembered_pages.clear();
+    auto sort_page = [](page *p)
+    {
+        p->in_nursery = false;
+        p->in_remembered = false;
+        for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+        {
+            if (p->remembered[w])
+            {
+                p->in_remembered = true;
+                remembered_pages.push_back(p);
+                break;
+            }
+        }
+    };
+    for (size_class_heap &heap : heaps)
+    {
+        for (page *p = heap.pages; p; p = p->next)
+        {
+            sort_page(p);
+            if (p->in_use)
+                enter_nursery(p);
+        }
+    }
+    for (page *p = large_pages; p; p = p->next)
+        sort_page(p);
+}
+
+gc::mark_bitmap::~mark_bitmap()
+{
+    for (word **second : top)
+        delete[] second;
+    for (word *block : blocks)
+        delete[] block;
+}
+
+void gc::mark_bitmap::ensure(const void *p)
+{
+    std::uintptr_t a = reinterpret_cast<std::uintptr_t>(p);
+    word **&second = top[(a >> (leaf_shift + table_bits)) & ((1 << table_bits) - 1)];
+    if (!second)
+        second = new word *[1 << table_bits]();
+
+    word *&w = second[(a >> leaf_shift) & ((1 << table_bits) - 1)];
+    if (w)
+        return;
+    if (!leaves_left)
+    {
+        blocks.push_back(new word[leaf_words * leaves_per_block]());
+        leaves_left = leaves_per_block;
+    }
+    w = blocks.back() + leaf_words * (leaves_per_block - leaves_left);
+    leaves_left--;
+}
+
+void gc::mark_bitmap::clear(const void *p)
+{
+    if (word *w = leaf(p))
+        std::memset(static_cast<void *>(w), 0, sizeof(word) * leaf_words);
+}
+
+void gc::mark_bitmap::clear()
+{
+    for (word *block : blocks)
+        std::memset(static_cast<void *>(block), 0, sizeof(word) * leaf_words * leaves_per_block);
+}
+
+gc::page_table::~page_table()
+{
+    for (page **second : top)
+        delete[] second;
+}
+
+void gc::page_table::set(page *p, page *value)
+{
+    std::uintptr_t begin = reinterpret_cast<std::uintptr_t>(p);
+    for (std::uintptr_t a = begin; a < begin + p->span; a += page::size)
+    {
+        page **&second = top[(a >> (region_shift + table_bits)) & ((1 << table_bits) - 1)];
+        if (!second)
+        {
+            if (!value)
+                continue;
+            second = new page *[1 << table_bits]();
+        }
+        second[(a >> region_shift) & ((1 << table_bits) - 1)] = value;
+    }
+}
+
+gc::mark_deque::ring *gc::mark_deque::grow(ring *old, long b, long t)
+{
+    ring *bigger = new ring(old->capacity * 2);
+    for (long i = t; i < b; i++)
+        bigger->put(i, old->get(i));
+
+    retired.push_back(old);
+    array.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+gc::mark_deque::~mark_deque()
+{
+    release_retired();
+    delete array.load(std::memory_order_relaxed);
+}
+
+// taking them from the top leaves the owner's end untouched
+void gc::mark_deque::publish(long count)
+{
+    ring *a = array.load(std::memory_order_relaxed);
+    std::vector<gc_object *> batch(count);
+    while (true)
+    {
+        // one compare-and-swap for the whole batch, thieves only take from the top one at a time
+        long t = top.load(std::memory_order_acquire);
+        for (long i = 0; i < count; i++)
+            batch[i] = a->get(t + i);
+        if (top.compare_exchange_strong(t, t + count, std::memory_order_seq_cst, std::memory_order_relaxed))
+            break;
+    }
+
+    std::unique_lock<std::mutex> lock(packets_mutex);
+    packets.insert(packets.end(), batch.begin(), batch.end());
+    packets_available.store(true, std::memory_order_release);
+}
+
+// moves a packet to an empty deque, returns false if there were none
+bool gc::refill(mark_deque &into)
+{
+    if (!packets_available.load(std::memory_order_acquire))
+        return false;
+    std::unique_lock<std::mutex> lock(packets_mutex);
+    if (packets.empty())
+        return false;
+    std::size_t first = packets.size() > packet_size ? packets.size() - packet_size : 0;
+    for (std::size_t i = first; i < packets.size(); i++)
+        into.push(packets[i]);
+    packets.resize(first);
+    packets_available.store(!packets.empty(), std::memory_order_release);
+    return true;
+}
+
+void gc::take_mark_counts()
+{
+    last_stats.mark_stack_spills = spills.exchange(0);
+    last_stats.marked_per_worker.clear();
+    if (std::any_of(worker_marked.begin(), worker_marked.end(), [](std::size_t n) { return n != 0; }))
+        last_stats.marked_per_worker = worker_marked;
+    std::fill(worker_marked.begin(), worker_marked.end(), 0);
+}
+
+void gc::mark_deque::release_retired()
+{
+    for (ring *old : retired)
+        delete old;
+    retired.clear();
+}
+
+gc_object *gc::steal_job(int index)
+{
+    for (int i = 1; i < hw_threads; i++)
+    {
+        gc_object *job = deques[(index + i) % hw_threads]->steal();
+        if (job)
+            return job;
+    }
+    return nullptr;
+}
+
+bool gc::work_available(int index)
+{
+    if (packets_available.load(std::memory_order_acquire))
+        return true;
+    for (int i = 1; i < hw_threads; i++)
+    {
+        if (!deques[(index + i) % hw_threads]->empty())
+            return true;
+    }
+    return false;
+}
+
+void gc::mark_loop(int index)
+{
+    // children reported to the tracer are pushed in reverse, so they are traced in the order the object
+    // reports them (i.e. allocation order for trees built top-down) and the first one skips the deque
+    tracer t;
+    t.own = deques[index];
+    t.minor = minor_cycle;
+
+    gc_object *next = nullptr;
+    while (true)
+    {
+        gc_object *job = next ? next : t.own->pop();
+        next = nullptr;
+        if (!job && refill(*t.own))
+            job = t.own->pop();
+        if (!job)
+            job = steal_job(index);
+        bool found = job != nullptr;
+        job = found ? t.prefetched(job) : t.take_prefetched();
+        if (job)
+        {
+            t.scan(job);
+            if (t.unbarriered)
+                note_unbarriered(t, job);
+            next = t.flush();
+            // idle workers get a packet of the oldest (usually biggest) pending work at once instead
+            // of stealing it object by object
+            if (idle_markers.load(std::memory_order_relaxed) && t.own->size() > 2 * packet_size)
+                t.own->publish(packet_size);
+            continue;
+        }
+        if (found)
+            continue;
+
+        // nothing to do, idle until another worker publishes work or everybody is idle
+        idle_markers += 1;
+        while (true)
+        {
+            if (idle_markers == hw_threads)
+            {
+                marked_objects += t.marked;
+                worker_marked[index] += t.marked;
+                return;
+            }
+            if (work_available(index))
+            {
+                idle_markers -= 1;
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+void gc::threadpool_loop(int index)
+{
+    unsigned long seen_epoch = 0;
+    // tasks come in bursts (the sweep after the mark, collect_step and preclean rounds), so spin
+    // for a while before going to sleep, unless spinning would only take the cpu from the mutator
+    while (true)
+    {
+        if (spin_workers)
+        {
+            auto spin_end = std::chrono::steady_clock::now() + spin_time;
+            while (pool_epoch.load(std::memory_order_acquire) == seen_epoch && std::chrono::steady_clock::now() < spin_end)
+                std::this_thread::yield();
+        }
+
+        if (pool_epoch.load(std::memory_order_acquire) == seen_epoch)
+        {
+            std::unique_lock<std::mutex> lock(threadpool_mutex);
+            sleeping_workers++;
+            threadpool_condition.wait(lock, [&]()
+                                      { return pool_epoch.load(std::memory_order_relaxed) != seen_epoch || terminate_pool; });
+            sleeping_workers--;
+            if (terminate_pool)
+                break;
+        }
+        seen_epoch = pool_epoch.load(std::memory_order_acquire);
+        pool_task what = task;
+
+        long long waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - pool_start).count();
+        long long longest = longest_wake.load(std::memory_order_relaxed);
+        while (waited > longest && !longest_wake.compare_exchange_weak(longest, waited, std::memory_order_relaxed))
+        {
+        }
+
+        if (what == pool_task::mark)
+            mark_loop(index);
+        else
+            sweep_loop();
+
+        // the last worker to finish wakes up the main thread
+        if (--running_workers == 0)
+        {
+            std::unique_lock<std::mutex> lock(wait_mutex);
+            end_of_task_condition.notify_one();
+        }
+    }
+}
+
+// runs one task on every pool thread and waits until all of them are done
+void gc::run_pool(pool_task what)
+{
+    start_pool(what);
+    wait_pool();
+}
+
+void gc::start_pool(pool_task what)
+{
+    running_workers = hw_threads;
+    bool wake;
+    {
+        std::unique_lock<std::mutex> lock(threadpool_mutex);
+        task = what;
+        pool_start = std::chrono::steady_clock::now();
+        pool_epoch.fetch_add(1, std::memory_order_release);
+        wake = sleeping_workers > 0;
+    }
+    // spinning workers see the new epoch by themselves
+    if (wake)
+        threadpool_condition.notify_all();
+}
+
+void gc::wait_pool()
+{
+    std::unique_lock<std::mutex> myLock(wait_mutex);
+    end_of_task_condition.wait(myLock, [&]()
+                               { return running_workers == 0; });
+}
+
+void gc::terminate_threads()
+{
+    {
+        std::unique_lock<std::mutex> lock(threadpool_mutex);
+        terminate_pool = true;
+    }
+
+    threadpool_condition.notify_all();
+    for (std::thread &every_thread : pool)
+    {
+        every_thread.join();
+    }
+
+    pool.clear();
+    for (mark_deque *deque : deques)
+        delete deque;
+    deques.clear();
+    stopped = true;
+}
+void gc::start_threadpool()
+{
+    int cpus = usable_cpus();
+    hw_threads = config.threads > 0 ? config.threads : cpus;
+    spin_workers = cpus > 1;
+    spin_time = config.spin;
+    worker_marked.assign(hw_threads, 0);
+    terminate_pool = false;
+    pool_epoch = 0;
+    for (int i = 0; i < hw_threads; i++)
+    {
+        deques.push_back(new mark_deque());
+    }
+    for (int i = 0; i < hw_threads; i++)
+    {
+        pool.push_back(std::thread(threadpool_loop, i));
+#ifdef __linux__
+        if (!config.cpus.empty())
+        {
+            cpu_set_t pinned;
+            CPU_ZERO(&pinned);
+            CPU_SET(config.cpus[i % config.cpus.size()], &pinned);
+            pthread_setaffinity_np(pool.back().native_handle(), sizeof(pinned), &pinned);
+        }
+#endif
+    }
+    stopped = false;
+}
+
+void gc::init()
+{
+    stopped_world world;
+    if (stopped)
+        start_threadpool();
+}
+
+void gc::init(const options &requested)
+{
+    stopped_world world;
+    configure(requested);
+    if (stopped)
+        start_threadpool();
+}
+
+void gc::configure(const options &requested)
+{
+    stopped_world world;
+    options o = requested;
+    environment_overrides(o);
+    o.promotion_age = std::min(std::max(o.promotion_age, 1), 4);
+    o.prefetch = std::min(std::max(o.prefetch, 0), tracer::max_prefetch);
+    bool restart = !stopped && (o.threads != config.threads || o.cpus != config.cpus || o.spin != config.spin);
+    if (restart || (o.prefetch != prefetch_depth && cycle == cycle_kind::concurrent))
+        abandon_cycle();
+    if (restart)
+        terminate_threads();
+
+    {
+        std::unique_lock<std::mutex> guard(config_mutex);
+        config = o;
+    }
+    pool_size = 0;
+    prefetch_depth = o.prefetch;
+    sweeping = o.sweep;
+    promotion_age = o.promotion_age;
+    update_collect_at();
+    if (restart)
+        start_threadpool();
+}
+
+gc::options gc::configuration()
+{
+    std::unique_lock<std::mutex> guard(config_mutex);
+    return config;
+}
+
+// called after marking, before the sweep: the live part of the heap is estimated from the share of its
+// objects that were marked, lazy and concurrent sweeping would leave the garbage counted for a while
+void gc::update_collect_at()
+{
+    if (config.heap_growth <= 0)
+    {
+        collect_at = SIZE_MAX;
+        return;
+    }
+    std::size_t objects = 0;
+    for (size_class_heap &heap : heaps)
+    {
+        for (page *p = heap.pages; p; p = p->next)
+            objects += p->used;
+    }
+    for (page *p = large_pages; p; p = p->next)
+        objects++;
+    double live = double(heap_bytes);
+    if (objects > last_stats.live_objects)
+        live = live * double(last_stats.live_objects) / double(objects);
+    collect_at = std::max(std::size_t(live * config.heap_growth), min_collect_bytes);
+}
+
+// called by allocation before the heap grows, not while this thread collects (e.g. from a destructor)
+void gc::maybe_collect()
+{
+    if (heap_bytes.load(std::memory_order_relaxed) >= collect_at.load(std::memory_order_relaxed) && !world_held)
+        collect_full();
+}
+
+void gc::shutdown()
+{
+    stopped_world world;
+    abandon_cycle();
+    stop_sweeper();
+    stop_finalizer();
+    if (!stopped)
+        terminate_threads();
+}
+
+// waking the pool costs tens of microseconds, more than tracing a small heap takes on the calling thread
+bool gc::mark_serially(std::size_t roots)
+{
+    switch (config.marking)
+    {
+    case marking_mode::serial:
+        return true;
+    case marking_mode::parallel:
+        return false;
+    default:
+        break;
+    }
+    // reading the cgroup limits every cycle would cost about as much as the small collections it decides about
+    if (!pool_size)
+        pool_size = config.threads > 0 ? config.threads : usable_cpus();
+    return pool_size == 1 || std::max(previous_live, roots) < config.serial_threshold;
+}
+
+// marks everything reachable from the roots and from what is already on the serial stack
+// (the remembered set of a minor collection)
+void gc::mark_from_roots()
+{
+    // the roots go to the serial stack first, their number decides who traces from them
+    mark_deque *into = &step_deque;
+    std::size_t roots = mark_roots(&into, 1);
+    last_stats.serial_mark = mark_serially(roots);
+    if (last_stats.serial_mark)
+    {
+        tracer t;
+        t.own = &step_deque;
+        t.minor = minor_cycle;
+        bool done;
+        trace_serially(t, SIZE_MAX, done);
+        step_deque.release_retired();
+    }
+    else
+    {
+        if (stopped)
+            start_threadpool();
+        // workers are parked, so the work can be dealt round-robin straight into their deques
+        int next_deque = 0;
+        while (gc_object *object = step_deque.pop_unshared())
+        {
+            deques[next_deque]->push(object);
+            next_deque = (next_deque + 1) % hw_threads;
+        }
+        step_deque.release_retired();
+        idle_markers = 0;
+        run_pool(pool_task::mark);
+        for (mark_deque *deque : deques)
+            deque->release_retired();
+    }
+    previous_live = marked_objects;
+}
+
+// marks the objects of all gc_root_ptrs and handles and deals them round-robin into the given deques,
+// returns how many it marked
+std::size_t gc::mark_roots(mark_deque **into, int count)
+{
+    // the mutators are stopped, so nobody changes the root lists or handle tables
+    for (std::size_t i = 0; i < root_lists.size();)
+    {
+        gc_root_list *list = root_lists[i];
+        bool empty = false;
+        if (list->orphaned)
+        {
+            // nothing links to an empty list of an exited thread any more
+            std::unique_lock<std::mutex> guard(list->lock);
+            empty = !list->head_root.next;
+        }
+        if (!empty)
+        {
+            i++;
+            continue;
+        }
+        root_lists.erase(root_lists.begin() + i);
+        delete list;
+    }
+
+    int next_deque = 0;
+    std::size_t marked = 0;
+    auto mark_root = [&](gc_object *object)
+    {
+        if (object && !(minor_cycle && is_old(object)) && marks.try_mark(object))
+        {
+            marked++;
+            marked_objects++;
+            if (!scanned(object))
+                return;
+            into[next_deque]->push(object);
+            next_deque = (next_deque + 1) % count;
+        }
+    };
+    for (gc_root_list *list : root_lists)
+    {
+        auto mark_iterator = list->head_root.next;
+        while (mark_iterator)
+        {
+            mark_root(mark_iterator->gc_object_pointer);
+            mark_iterator = mark_iterator->next;
+        }
+    }
+    for (mutator *m : mutators)
+    {
+        gc_handle_table &table = m->handles;
+        if (!table.next)
+            continue;
+        for (std::size_t i = 0; i < table.chunk; i++)
+        {
+            for (std::size_t j = 0; j < gc_handle_table::chunk_size; j++)
+                mark_root(table.chunks[i][j]);
+        }
+        for (gc_object **slot = table.chunks[table.chunk]; slot != table.next; slot++)
+            mark_root(*slot);
+    }
+
+    // what the threads allocated since their last safepoint survives, and as a constructor may still be
+    // filling it in, what its words point to is found conservatively instead of by tracing it
+    for (mutator *m : mutators)
+    {
+        for (page *p : m->fresh_pages)
+        {
+            for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+            {
+                std::uint64_t bits = p->fresh[w] & p->allocated[w];
+                while (bits)
+                {
+                    std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+                    gc_object *object = reinterpret_cast<gc_object *>(p->first + std::size_t(index) * p->object_size);
+                    if (!(minor_cycle && is_old(object)) && marks.try_mark(object))
+                    {
+                        marked++;
+                        marked_objects++;
+                    }
+                    void *const *words = reinterpret_cast<void *const *>(object);
+                    for (std::size_t i = 0; !p->leaf && i < p->object_size / sizeof(void *); i++)
+                        mark_root(fresh_target(words[i]));
+                }
+            }
+        }
+    }
+    return marked;
+}
+
+void gc::describe_type(const gc_object *object, const std::pair<std::ptrdiff_t, std::size_t> *fields, std::size_t count, bool unbarriered)
+{
+    std::uint64_t words[max_layout_words / 64] = {};
+    std::uint32_t word_count = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        std::ptrdiff_t offset = fields[i].first;
+        std::size_t size = fields[i].second;
+        if (offset < 0 || offset % sizeof(void *) || size % sizeof(void *) ||
+            std::size_t(offset) + size > max_layout_words * sizeof(void *))
+            return;
+        for (std::size_t w = offset / sizeof(void *); w < (offset + size) / sizeof(void *); w++)
+        {
+            words[w / 64] |= std::uint64_t(1) << (w % 64);
+            word_count = std::max(word_count, std::uint32_t(w / 64 + 1));
+        }
+    }
+
+    const void *vtable = *reinterpret_cast<const void *const *>(object);
+    std::unique_lock<std::mutex> lock(descriptors_mutex);
+    if (described_types.load(std::memory_order_relaxed) == descriptor_slots - 1 || descriptor_of(object))
+        return;
+    int i = descriptor_hash(vtable);
+    while (descriptors[i].vtable.load(std::memory_order_relaxed))
+        i = (i + 1) & (descriptor_slots - 1);
+    type_descriptor &d = descriptors[i];
+    d.unbarriered = unbarriered;
+    d.word_count = word_count;
+    std::memcpy(d.words, words, sizeof(words));
+    d.vtable.store(vtable, std::memory_order_release);
+    described_types++;
+    if (DEBUG)
+        std::cout << "pointer layout of " << count << " fields registered" << std::endl;
+}
+
+// runs once marking is complete, with the world stopped: values of gc_weak_maps whose key survives are
+// traced until that finds no more surviving keys (a value can reach the key of another entry), then the
+// entries with dead keys are dropped and gc_weak_ptrs to dead objects cleared
+void gc::process_weak()
+{
+    std::unique_lock<std::mutex> lock(weak_mutex);
+    bool found = true;
+    while (found)
+    {
+        found = false;
+        for (gc_weak_map_base *map : weak_maps)
+        {
+            for (auto &entry : map->entries)
+            {
+                if (entry.second && survives(entry.first) && !survives(entry.second) && marks.try_mark(entry.second))
+                {
+                    marked_objects++;
+                    if (scanned(entry.second))
+                        step_deque.push(entry.second);
+                    found = true;
+                }
+            }
+        }
+        if (found)
+        {
+            tracer t;
+            t.own = &step_deque;
+            t.minor = minor_cycle;
+            bool done;
+            trace_serially(t, SIZE_MAX, done);
+        }
+    }
+    step_deque.release_retired();
+
+    std::size_t cleared = 0;
+    for (gc_weak_map_base *map : weak_maps)
+    {
+        for (auto it = map->entries.begin(); it != map->entries.end();)
+        {
+            if (survives(it->first))
+                ++it;
+            else
+            {
+                it = map->entries.erase(it);
+                cleared++;
+            }
+        }
+    }
+    for (gc_weak_ptr_base *w = weak_ptrs; w; w = w->next)
+    {
+        gc_object *object = w->target.load(std::memory_order_relaxed);
+        if (object && !survives(object))
+        {
+            w->target.store(nullptr, std::memory_order_relaxed);
+            cleared++;
+        }
+    }
+    last_stats.weak_cleared = cleared;
+    if (DEBUG)
+        std::cout << "weak references cleared: " << cleared << std::endl;
+}
+
+// decides whether to compact after the marking of collect() and evacuates the chosen pages, their moved
+// slots are freed and the sweep that follows destroys the dead objects left in them
+void gc::compact()
+{
+    last_stats.fragmentation = 0;
+    last_stats.relocated_objects = 0;
+    if (config.compact_threshold <= 0 || generational)
+        return;
+
+    // a page qualifies if it is at least as sparse as the threshold and every live object in it can move,
+    // the pages mutators allocate from stay
+    std::size_t capacity = 0;
+    std::size_t live = 0;
+    std::vector<page *> evacuated;
+    for (size_class_heap &heap : heaps)
+    {
+        for (page *p = heap.pages; p; p = p->next)
+        {
+            if (p->in_use)
+                continue;
+            std::uint32_t marked = 0;
+            bool movable = true;
+            for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+            {
+                std::uint64_t bits = p->allocated[w];
+                while (bits)
+                {
+                    std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+                    std::uint64_t bit = bits & -bits;
+                    bits &= bits - 1;
+                    if (marks.is_marked(p->first + std::size_t(index) * p->object_size))
+                    {
+                        marked++;
+                        movable &= (p->relocatable[w] & ~p->fresh[w] & bit) != 0;
+                    }
+                }
+            }
+            capacity += p->capacity;
+            live += marked;
+            if (marked && movable && p->capacity - marked >= config.compact_threshold * p->capacity)
+                evacuated.push_back(p);
+        }
+    }
+    last_stats.fragmentation = capacity ? double(capacity - live) / capacity : 0;
+    if (evacuated.empty() || last_stats.fragmentation < config.compact_threshold)
+        return;
+
+    for (size_class_heap &heap : heaps)
+    {
+        for (page *p = heap.pages; p; p = p->next)
+            relocation_marks.ensure(p);
+    }
+    for (page *p = large_pages; p; p = p->next)
+        relocation_marks.ensure(p);
+
+    // pin what live objects report by value, and whatever fresh objects may point to, then drop the pages
+    // holding a pinned object
+    tracer t;
+    t.own = &step_deque;
+    t.compacting = true;
+    pinning = true;
+    auto pin = [&](page *p, std::uint64_t fresh, gc_object *object)
+    {
+        if (!marks.is_marked(object))
+            return;
+        if (!fresh)
+        {
+            t.scan(object);
+            return;
+        }
+        void *const *words = reinterpret_cast<void *const *>(object);
+        for (std::size_t i = 0; !p->leaf && i < p->object_size / sizeof(void *); i++)
+        {
+            if (gc_object *target = fresh_target(words[i]))
+                relocation_marks.try_mark(target);
+        }
+    };
+    for (size_class_heap &heap : heaps)
+    {
+        for (page *p = heap.pages; p; p = p->next)
+        {
+            for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+            {
+                std::uint64_t bits = p->allocated[w];
+                while (bits)
+                {
+                    std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+                    std::uint64_t bit = bits & -bits;
+                    bits &= bits - 1;
+                    pin(p, p->fresh[w] & bit, reinterpret_cast<gc_object *>(p->first + std::size_t(index) * p->object_size));
+                }
+            }
+        }
+    }
+    for (page *p = large_pages; p; p = p->next)
+        pin(p, p->fresh[0], reinterpret_cast<gc_object *>(p->first));
+    pinning = false;
+
+    std::size_t kept = 0;
+    for (page *p : evacuated)
+    {
+        bool pinned = false;
+        for (std::uint32_t index = 0; index < p->bump && !pinned; index++)
+            pinned = relocation_marks.is_marked(p->first + std::size_t(index) * p->object_size);
+        if (pinned)
+            continue;
+        p->evacuating = true;
+        evacuated[kept++] = p;
+    }
+    evacuated.resize(kept);
+    relocation_marks.clear();
+    if (evacuated.empty())
+        return;
+
+    // depth-first from each root in turn, objects are copied when first reached and traced from the copy
+    auto trace_from = [&](gc_object *&root)
+    {
+        root = relocate(t, root, true);
+        while (true)
+        {
+            gc_object *object = step_deque.pop_unshared();
+            if (!object && refill(step_deque))
+                object = step_deque.pop_unshared();
+            if (!object)
+                break;
+            t.scan(object);
+        }
+    };
+    for (gc_root_list *list : root_lists)
+    {
+        for (gc_root_ptr_base *root = list->head_root.next; root; root = root->next)
+            trace_from(root->gc_object_pointer);
+    }
+    for (mutator *m : mutators)
+    {
+        gc_handle_table &table = m->handles;
+        if (!table.next)
+            continue;
+        for (std::size_t i = 0; i < table.chunk; i++)
+        {
+            for (std::size_t j = 0; j < gc_handle_table::chunk_size; j++)
+                trace_from(table.chunks[i][j]);
+        }
+        for (gc_object **slot = table.chunks[table.chunk]; slot != table.next; slot++)
+            trace_from(*slot);
+    }
+    {
+        std::unique_lock<std::mutex> lock(weak_mutex);
+        for (gc_weak_map_base *map : weak_maps)
+        {
+            for (auto &entry : map->entries)
+                trace_from(entry.second);
+        }
+        step_deque.release_retired();
+
+        // every weak referent is alive (process_weak cleared the others) and has been reached
+        auto forwarded = [](gc_object *object)
+        {
+            return object && page::of(object)->evacuating ? *reinterpret_cast<gc_object **>(object) : object;
+        };
+        for (gc_weak_ptr_base *w = weak_ptrs; w; w = w->next)
+            w->target.store(forwarded(w->target.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        for (gc_weak_map_base *map : weak_maps)
+        {
+            std::unordered_map<gc_object *, gc_object *> entries;
+            entries.reserve(map->entries.size());
+            for (auto &entry : map->entries)
+                entries.emplace(forwarded(entry.first), entry.second);
+            map->entries.swap(entries);
+        }
+    }
+
+    // the moved slots are free now, the dead objects are left to the sweep
+    std::size_t relocated = 0;
+    for (page *p : evacuated)
+    {
+        for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+        {
+            std::uint64_t bits = p->allocated[w];
+            while (bits)
+            {
+                std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+                std::uint64_t bit = bits & -bits;
+                bits &= bits - 1;
+
+                char *slot = p->first + std::size_t(index) * p->object_size;
+                if (!marks.is_marked(slot))
+                    continue;
+                p->allocated[w] &= ~bit;
+                p->trivial[w] &= ~bit;
+                p->relocatable[w] &= ~bit;
+                p->used--;
+                *reinterpret_cast<void **>(slot) = p->free_list;
+                p->free_list = slot;
+                relocated++;
+            }
+        }
+        p->evacuating = false;
+    }
+    for (page *&p : evacuation_targets)
+        p = nullptr;
+    relocation_marks.clear();
+    last_stats.relocated_objects = relocated;
+    if (DEBUG)
+        std::cout << "compaction moved " << relocated << " objects out of " << evacuated.size() << " pages" << std::endl;
+}
+
+// what compaction makes of a reference: while pinning it only notes the targets of references it cannot
+// update, then it copies objects of evacuated pages when first reached and queues every object it
+// reaches for the first time to be traced
+gc_object *gc::relocate(tracer &t, gc_object *object, bool updatable)
+{
+    if (!object)
+        return nullptr;
+    if (pinning)
+    {
+        if (!updatable)
+            relocation_marks.try_mark(object);
+        return object;
+    }
+    if (!page::of(object)->evacuating)
+    {
+        if (relocation_marks.try_mark(object))
+            t.own->push(object);
+        return object;
+    }
+    if (!relocation_marks.try_mark(object))
+        return *reinterpret_cast<gc_object **>(object);
+    gc_object *copy = evacuate(object);
+    relocation_marks.try_mark(copy);
+    t.own->push(copy);
+    return copy;
+}
+
+// copies the object to the page its size class is evacuated to and leaves a forwarding pointer behind
+gc_object *gc::evacuate(gc_object *object)
+{
+    page *from = page::of(object);
+    page *&to = evacuation_targets[from->size_class];
+    if (!to || to->bump == to->capacity)
+    {
+        to = new_page(from->size_class);
+        relocation_marks.ensure(to);
+    }
+    std::uint32_t index = to->bump++;
+    char *slot = to->first + std::size_t(index) * to->object_size;
+    std::memcpy(slot, static_cast<void *>(object), from->object_size);
+
+    std::uint32_t old = from->slot_index(object);
+    std::uint64_t bit = std::uint64_t(1) << (index % 64);
+    to->allocated[index / 64] |= bit;
+    to->relocatable[index / 64] |= bit;
+    if ((from->trivial[old / 64] >> (old % 64)) & 1)
+        to->trivial[index / 64] |= bit;
+    to->used++;
+    marks.try_mark(slot);
+
+    gc_object *copy = reinterpret_cast<gc_object *>(slot);
+    *reinterpret_cast<gc_object **>(object) = copy;
+    return copy;
+}
+
+// sweeps according to the sweep mode once marking is complete
+void gc::finish_cycle(std::chrono::steady_clock::time_point sweep_start)
+{
+    last_stats.live_objects = marked_objects;
+    last_stats.freed_objects = 0;
+    take_mark_counts();
+    update_collect_at();
+    if (sweeping == sweep_mode::lazy && !generational)
+        defer_sweep();
+    else if (sweeping == sweep_mode::concurrent && !generational)
+    {
+        defer_sweep();
+        if (!sweeper.joinable())
+            sweeper = std::thread(sweeper_loop);
+        sweeper_condition.notify_one();
+    }
+    else
+    {
+        if (sweeping == sweep_mode::parallel && stopped)
+            start_threadpool();
+        last_stats.freed_objects = sweep();
+        if (generational)
+            reset_generations();
+        marks.clear();
+    }
+    start_finalizer();
+    last_stats.sweep_time += std::chrono::steady_clock::now() - sweep_start;
+}
+
+void gc::collect()
+{
+    forget_fresh();
+    collect_full();
+}
+
+void gc::collect_full()
+{
+    stopped_world world;
+    abandon_cycle();
+
+    // marks of pages lazy sweeping has not reached yet are still needed
+    auto finish_start = std::chrono::steady_clock::now();
+    finish_sweep();
+
+    auto mark_start = std::chrono::steady_clock::now();
+    last_stats = statistics();
+    longest_wake = 0;
+    marked_objects = 0;
+    mark_from_roots();
+    process_weak();
+
+    auto mark_end = std::chrono::steady_clock::now();
+    compact();
+    auto sweep_start = std::chrono::steady_clock::now();
+    last_stats.mark_time = mark_end - mark_start;
+    last_stats.compact_time = sweep_start - mark_end;
+    last_stats.longest_step = last_stats.mark_time;
+    last_stats.mark_steps = 1;
+    last_stats.sweep_time = mark_start - finish_start;
+    finish_cycle(sweep_start);
+}
+
+void gc::satb_log(gc_object *old)
+{
+    if (marks.is_marked(old))
+        return;
+    std::unique_lock<std::mutex> lock(satb_mutex);
+    satb_buffer.push_back(old);
+}
+
+// moves the pointers logged by the write barrier to the mark stack, returns false if there were none
+bool gc::drain_satb(mark_deque &into)
+{
+    std::unique_lock<std::mutex> lock(satb_mutex);
+    bool found = false;
+    for (gc_object *object : satb_buffer)
+    {
+        if (marks.try_mark(object))
+        {
+            marked_objects++;
+            if (scanned(object))
+            {
+                into.push(object);
+                found = true;
+            }
+        }
+    }
+    satb_buffer.clear();
+    return found;
+}
+
+// traces from step_deque (and the barrier's log) on the calling thread, at most budget objects; the pool and the
+// mutators must not be marking meanwhile
+void gc::trace_serially(tracer &t, std::size_t budget, bool &done)
+{
+    done = false;
+    t.alone = true;
+    // like mark_loop, the first child of the object just traced skips the deque
+    gc_object *next = nullptr;
+    for (std::size_t traced = 0; traced < budget;)
+    {
+        gc_object *job = next ? next : step_deque.pop_unshared();
+        next = nullptr;
+        if (!job && (refill(step_deque) || drain_satb(step_deque)))
+            job = step_deque.pop_unshared();
+        bool found = job != nullptr;
+        job = found ? t.prefetched(job) : t.take_prefetched();
+        if (!job)
+        {
+            if (found)
+                continue;
+            done = true;
+            break;
+        }
+        t.scan(job);
+        traced++;
+        if (t.unbarriered)
+            note_unbarriered(t, job);
+        next = t.flush();
+    }
+    // the next step starts with a new tracer
+    if (next)
+        step_deque.push(next);
+    while (gc_object *queued = t.take_prefetched())
+        step_deque.push(queued);
+    marked_objects += t.marked;
+}
+
+bool gc::collect_step(std::size_t budget)
+{
+    forget_fresh();
+    stopped_world world;
+    if (cycle == cycle_kind::concurrent)
+        abandon_cycle();
+
+    auto step_start = std::chrono::steady_clock::now();
+    if (cycle == cycle_kind::none)
+    {
+        // snapshot: everything reachable now will be marked, the barrier keeps overwritten edges visible
+        auto finish_start = step_start;
+        finish_sweep();
+        step_start = std::chrono::steady_clock::now();
+
+        marked_objects = 0;
+        mark_deque *into = &step_deque;
+        mark_roots(&into, 1);
+        marking_active = true;
+        cycle = cycle_kind::incremental;
+        last_stats = statistics();
+        last_stats.sweep_time = step_start - finish_start;
+        longest_wake = 0;
+    }
+
+    tracer t;
+    t.own = &step_deque;
+    bool done;
+    trace_serially(t, budget, done);
+
+    auto step_end = std::chrono::steady_clock::now();
+    last_stats.mark_time += step_end - step_start;
+    last_stats.longest_step = std::max<std::chrono::nanoseconds>(last_stats.longest_step, step_end - step_start);
+    last_stats.mark_steps++;
+    if (!done)
+        return false;
+
+    process_weak();
+    marking_active = false;
+    cycle = cycle_kind::none;
+    step_deque.release_retired();
+    finish_cycle(step_end);
+    return true;
+}
+
+void gc::start_concurrent_collect()
+{
+    forget_fresh();
+    stopped_world world;
+    abandon_cycle();
+
+    auto finish_start = std::chrono::steady_clock::now();
+    finish_sweep();
+    if (stopped)
+    {
+        start_threadpool();
+    }
+
+    // the only pause before the remark: mark the roots and turn the barrier on, the pool does the rest
+    cycle_start = std::chrono::steady_clock::now();
+    last_stats = statistics();
+    last_stats.sweep_time = cycle_start - finish_start;
+    longest_wake = 0;
+    marked_objects = 0;
+    marking_active = true;
+    mark_roots(deques.data(), hw_threads);
+    cycle = cycle_kind::concurrent;
+
+    round_start = marked_objects;
+    idle_markers = 0;
+    start_pool(pool_task::mark);
+    last_stats.snapshot_time = std::chrono::steady_clock::now() - cycle_start;
+    last_stats.mark_steps = 1;
+}
+
+bool gc::concurrent_collect_poll()
+{
+    // the final remark waits until a concurrent round marked at most this many objects and the log is
+    // no longer, and traces at most this many itself before it hands the rest back to the pool
+    constexpr std::size_t remark_budget = 4096;
+
+    if (cycle != cycle_kind::concurrent)
+        return true;
+    if (running_workers != 0)
+        return false;
+    for (mark_deque *deque : deques)
+        deque->release_retired();
+
+    std::vector<gc_object *> logged;
+    {
+        std::unique_lock<std::mutex> lock(satb_mutex);
+        if (!satb_buffer.empty() && (marked_objects - round_start > remark_budget || satb_buffer.size() > remark_budget))
+            logged.swap(satb_buffer);
+    }
+    if (!logged.empty())
+    {
+        // preclean: what the mutators overwrote in the meantime is traced concurrently as well
+        round_start = marked_objects;
+        int next_deque = 0;
+        for (gc_object *object : logged)
+        {
+            if (!marks.try_mark(object))
+                continue;
+            marked_objects++;
+            if (scanned(object))
+            {
+                deques[next_deque]->push(object);
+                next_deque = (next_deque + 1) % hw_threads;
+            }
+        }
+        idle_markers = 0;
+        start_pool(pool_task::mark);
+        last_stats.mark_steps++;
+        return false;
+    }
+
+    // final remark, the mutators are stopped: the rest of the log and whatever it reaches
+    stopped_world world;
+    auto remark_start = std::chrono::steady_clock::now();
+    std::size_t remark_from = marked_objects;
+    tracer t;
+    t.own = &step_deque;
+    bool done;
+    trace_serially(t, remark_budget, done);
+    auto remark_end = std::chrono::steady_clock::now();
+    last_stats.longest_step = std::max<std::chrono::nanoseconds>(last_stats.longest_step, remark_end - remark_start);
+    if (!done)
+    {
+        // the log led to more than a pause should trace, the pool goes on with it concurrently
+        round_start = marked_objects;
+        int next_deque = 0;
+        while (gc_object *object = step_deque.pop_unshared())
+        {
+            deques[next_deque]->push(object);
+            next_deque = (next_deque + 1) % hw_threads;
+        }
+        step_deque.release_retired();
+        idle_markers = 0;
+        start_pool(pool_task::mark);
+        last_stats.mark_steps++;
+        return false;
+    }
+    process_weak();
+    marking_active = false;
+    cycle = cycle_kind::none;
+    step_deque.release_retired();
+
+    remark_end = std::chrono::steady_clock::now();
+    last_stats.remark_time = remark_end - remark_start;
+    last_stats.remark_objects = marked_objects - remark_from;
+    last_stats.mark_time = remark_end - cycle_start;
+    last_stats.longest_step = std::max({last_stats.longest_step, last_stats.snapshot_time, last_stats.remark_time});
+    finish_cycle(remark_end);
+    return true;
+}
+
+void gc::finish_concurrent_collect()
+{
+    while (!concurrent_collect_poll())
+        wait_pool();
+}
+
+void gc::collect_minor()
+{
+    forget_fresh();
+    stopped_world world;
+    abandon_cycle();
+
+    auto finish_start = std::chrono::steady_clock::now();
+    finish_sweep();
+    if (!generational)
+    {
+        // nothing is old yet, so the first minor collection traces and sweeps everything
+        generational = true;
+        for (size_class_heap &heap : heaps)
+        {
+            for (page *p = heap.pages; p; p = p->next)
+                enter_nursery(p);
+        }
+        for (page *p = large_pages; p; p = p->next)
+            enter_nursery(p);
+    }
+
+    auto mark_start = std::chrono::steady_clock::now();
+    last_stats = statistics();
+    longest_wake = 0;
+    marked_objects = 0;
+    minor_cycle = true;
+
+    // the remembered set: old objects are traced without being marked (and forgotten once they point
+    // to no young object any more), young ones are roots
+    tracer t;
+    t.own = &step_deque;
+    t.minor = true;
+    std::size_t kept = 0;
+    for (page *p : remembered_pages)
+    {
+        std::uint64_t left = 0;
+        for (std::uint32_t w = 0; w * 64 < p->bump; w++)
+        {
+            std::uint64_t bits = p->remembered[w];
+            while (bits)
+            {
+                std::uint32_t index = w * 64 + __builtin_ctzll(bits);
+                std::uint64_t bit = bits & -bits;
+                bits &= bits - 1;
+
+                gc_object *object = reinterpret_cast<gc_object *>(p->first + std::size_t(index) * p->object_size);
+                if (!(p->old[w] & bit))
+                {
+                    if (marks.try_mark(object))
+                    {
+                        t.marked++;
+                        if (scanned(object))
+                            t.own->push(object);
+                    }
+                    continue;
+                }
+                t.young_refs = 0;
+                t.unbarriered = false;
+                t.scan(object);
+                if (gc_object *first = t.flush())
+                    t.own->push(first);
+                if (!t.young_refs && !t.unbarriered)
+                    p->remembered[w] &= ~bit;
+            }
+            left |= p->remembered[w];
+        }
+        if (left)
+            remembered_pages[kept++] = p;
+        else
+            p->in_remembered = false;
+    }
+    remembered_pages.resize(kept);
+    marked_objects += t.marked;
+
+    mark_from_roots();
+    process_weak();
+    minor_cycle = false;
+
+    // only the nursery is swept, old objects were neither marked nor are they touched
+    auto sweep_start = std::chrono::steady_clock::now();
+    std::size_t freed = 0;
+    std::size_t promoted = 0;
+    std::vector<page *> nursery;
+    nursery.swap(nursery_pages);
+    for (page *p : nursery)
+    {
+        if (sweep_young(p, freed, promoted, config.finalizer ? &dead_objects : nullptr))
+            nursery_pages.push_back(p);
+    }
+    release_empty_pages();
+    start_finalizer();
+
+    auto sweep_end = std::chrono::steady_clock::now();
+    last_stats.mark_time = sweep_start - mark_start;
+    last_stats.longest_step = last_stats.mark_time;
+    last_stats.mark_steps = 1;
+    last_stats.sweep_time = (mark_start - finish_start) + (sweep_end - sweep_start);
+    last_stats.live_objects = marked_objects;
+    last_stats.freed_objects = freed;
+    last_stats.promoted_objects = promoted;
+    take_mark_counts();
+    if (DEBUG)
+        std::cout << "collect_minor freed " << freed << ", promoted " << promoted << std::endl;
+}
+
+void gc::set_promotion_age(int cycles)
+{
+    options o = configuration();
+    o.promotion_age = cycles;
+    configure(o);
+}
+
+// drops the marks of an unfinished incremental or concurrent cycle, nothing has been swept yet
+void gc::abandon_cycle()
+{
+    if (cycle == cycle_kind::none)
+        return;
+    if (cycle == cycle_kind::concurrent)
+    {
+        wait_pool();
+        for (mark_deque *deque : deques)
+            deque->release_retired();
+    }
+    while (step_deque.pop_unshared())
+    {
+    }
+    step_deque.release_retired();
+    packets.clear();
+    packets_available = false;
+    take_mark_counts();
+    satb_buffer.clear();
+    marks.clear();
+    marking_active = false;
+    cycle = cycle_kind::none;
+}
+
+void gc::set_sweep_mode(sweep_mode mode)
+{
+    options o = configuration();
+    o.sweep = mode;
+    configure(o);
+}
 
-std::atomic<int> gc::thread_finish_counter = 0;
-std::atomic<int> gc::job_counter = 0;
-std::atomic<int> gc::fork_counter = 0;
+gc::statistics gc::last_statistics()
+{
+    statistics stats = last_stats;
+    stats.wake_latency = std::chrono::nanoseconds(longest_wake.load());
+    return stats;
+}
+std::condition_variable gc::threadpool_condition;
+std::condition_variable gc::end_of_task_condition;
+
+std::mutex gc::wait_mutex;
+std::mutex gc::threadpool_mutex;
+
+std::vector<std::thread> gc::pool;
+std::vector<gc::mark_deque *> gc::deques;
+gc::mark_bitmap gc::marks;
+
+gc::size_class_heap gc::heaps[gc::heap_count];
+gc::page *gc::large_pages = nullptr;
+bool gc::sweep_pending = false;
+bool gc::large_sweep_pending = false;
+
+std::mutex gc::heap_mutex;
+std::condition_variable gc::sweeper_condition;
+std::condition_variable gc::sweep_done_condition;
+std::thread gc::sweeper;
+bool gc::sweeper_stop = false;
+
+std::mutex gc::finalizer_mutex;
+std::condition_variable gc::finalizer_condition;
+std::condition_variable gc::finalized_condition;
+std::thread gc::finalizer;
+std::vector<void *> gc::dead_objects;
+std::vector<void *> gc::finalizer_queue;
+bool gc::finalizer_busy = false;
+bool gc::finalizer_stop = false;
+std::size_t gc::unswept_pages = 0;
+int gc::sweeps_in_flight = 0;
+int gc::next_unswept_class = 0;
+
+bool gc::terminate_pool = false;
+bool gc::stopped = true;
+int gc::sleeping_workers = 0;
+bool gc::spin_workers = false;
+std::chrono::microseconds gc::spin_time{50};
+int gc::prefetch_depth = 0;
+int gc::hw_threads;
+gc::pool_task gc::task = gc::pool_task::mark;
+std::atomic<unsigned long> gc::pool_epoch = 0;
+std::atomic<int> gc::running_workers = 0;
+std::chrono::steady_clock::time_point gc::pool_start;
+std::atomic<long long> gc::longest_wake = 0;
+
+std::atomic<int> gc::idle_markers = 0;
+std::atomic<std::size_t> gc::marked_objects = 0;
+std::size_t gc::previous_live = 0;
+int gc::pool_size = 0;
+
+gc::cycle_kind gc::cycle = gc::cycle_kind::none;
+std::atomic<bool> gc::marking_active = false;
+gc::mark_deque gc::step_deque;
+std::mutex gc::packets_mutex;
+std::vector<gc_object *> gc::packets;
+std::atomic<bool> gc::packets_available = false;
+std::atomic<std::size_t> gc::spills = 0;
+std::vector<std::size_t> gc::worker_marked;
+std::chrono::steady_clock::time_point gc::cycle_start;
+std::size_t gc::round_start = 0;
+std::mutex gc::satb_mutex;
+std::vector<gc_object *> gc::satb_buffer;
+std::mutex gc::weak_mutex;
+gc_weak_ptr_base *gc::weak_ptrs = nullptr;
+std::vector<gc_weak_map_base *> gc::weak_maps;
+gc::type_descriptor gc::descriptors[gc::descriptor_slots];
+std::atomic<int> gc::described_types = 0;
+std::mutex gc::descriptors_mutex;
+gc::mark_bitmap gc::relocation_marks;
+bool gc::pinning = false;
+gc::page *gc::evacuation_targets[gc::heap_count] = {};
+
+gc::page_table gc::page_map;
+bool gc::generational = false;
+bool gc::minor_cycle = false;
+int gc::promotion_age = 2;
+std::vector<gc::page *> gc::nursery_pages;
+std::vector<gc::page *> gc::remembered_pages;
+
+thread_local gc::mutator *gc::self = nullptr;
+thread_local gc_handle_table *gc::handle_table = nullptr;
+thread_local gc::page *gc::sweeping_here = nullptr;
+std::vector<gc::mutator *> gc::mutators;
+std::vector<gc_root_list *> gc::root_lists;
+
+std::mutex gc::world_mutex;
+std::condition_variable gc::world_condition;
+std::condition_variable gc::resume_condition;
+std::atomic<bool> gc::safepoint_requested = false;
+bool gc::world_stopped = false;
+std::thread::id gc::world_owner;
+int gc::world_depth = 0;
+int gc::parked = 0;
+
+std::vector<gc::page *> gc::sweep_pages;
+std::atomic<std::size_t> gc::next_sweep_page = 0;
+std::atomic<std::size_t> gc::swept_objects = 0;
+
+gc::sweep_mode gc::sweeping = gc::sweep_mode::serial;
+gc::statistics gc::last_stats;
+gc::options gc::config;
+std::mutex gc::config_mutex;
+std::atomic<std::size_t> gc::heap_bytes = 0;
+std::atomic<std::size_t> gc::collect_at = SIZE_MAX;
+thread_local int gc::world_held = 0;
+
+namespace
+{
+    // applies the environment variables before main
+    struct environment_configuration
+    {
+        environment_configuration()
+        {
+            gc::configure(gc::configuration());
+        }
+    } configure_from_environment;
+
+    // the pool threads have to be joined before the statics above are destroyed
+    struct pool_shutdown
+    {
+        ~pool_shutdown()
+        {
+            gc::shutdown();
+        }
+    } shutdown_at_exit;
+}
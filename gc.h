@@ -1,53 +1,1455 @@
-#ifndef HEADER_FILE_H
-#define HEADER_FILE_H
+#ifndef GC_H
+#define GC_H
 
 #include <functional>
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
 
+// build with -DDEBUG=1 to trace the collector on stdout
+#ifndef DEBUG
 #define DEBUG 0
+#endif
+
+// gc_objects live in the collector's arenas (see gc::page), the vtable pointer is their only header and
+// serves as the type descriptor (destructor, trace); mark bits, size and allocation state are kept in
+// the page header and the side mark bitmap
+class gc_object_base
+{
+private:
+    friend class gc_object;
+    friend class gc;
+
+public:
+    virtual ~gc_object_base() {}
+};
+
+
+class gc_object;
+struct gc_root_list;
+struct gc_handle_table;
+class gc_weak_ptr_base;
+class gc_weak_map_base;
+
+template <typename T>
+class gc_member_ptr;
+
+class gc
+{
+private:
+    template <typename T>
+    friend class gc_root_ptr;
+    template <typename T>
+    friend class gc_member_ptr;
+    friend class gc_object;
+    friend class gc_root_ptr_base;
+    friend class gc_handle_scope;
+    template <typename T>
+    friend class gc_handle;
+    friend class gc_weak_ptr_base;
+    friend class gc_weak_map_base;
+    template <typename K, typename V>
+    friend class gc_weak_map;
+    friend class gc_leaf_object;
+    friend class gc_bytes;
+    friend class gc_array_base;
+    template <typename T>
+    friend class gc_array;
+
+    // side mark bitmap with one bit per 16 byte granule of address space
+    // bits are kept in 512 byte leaves (covering 64 KiB each) reached through a two level table,
+    // leaves are carved out of large blocks so clearing the marks is a memset per block
+    class mark_bitmap
+    {
+    private:
+        static constexpr int granule_shift = 4;
+        static constexpr int leaf_shift = 16;
+        static constexpr int table_bits = 16;
+        static constexpr int leaf_words = (1 << (leaf_shift - granule_shift)) / 64;
+        static constexpr int leaves_per_block = 256;
+
+        typedef std::atomic<std::uint64_t> word;
+        static_assert(sizeof(word) == sizeof(std::uint64_t), "mark words are cleared with memset");
+
+        // bits 47..32 index the top table, bits 31..16 the second level
+        word **top[1 << table_bits] = {};
+        std::vector<word *> blocks;
+        int leaves_left = 0;
+
+        word *leaf(const void *p) const
+        {
+            std::uintptr_t a = reinterpret_cast<std::uintptr_t>(p);
+            word **second = top[(a >> (leaf_shift + table_bits)) & ((1 << table_bits) - 1)];
+            if (!second)
+                return nullptr;
+            return second[(a >> leaf_shift) & ((1 << table_bits) - 1)];
+        }
+        static int word_index(const void *p)
+        {
+            return (reinterpret_cast<std::uintptr_t>(p) >> (granule_shift + 6)) & (leaf_words - 1);
+        }
+        static std::uint64_t bit(const void *p)
+        {
+            return std::uint64_t(1) << ((reinterpret_cast<std::uintptr_t>(p) >> granule_shift) & 63);
+        }
+
+    public:
+        mark_bitmap() {}
+        mark_bitmap(const mark_bitmap &) = delete;
+        mark_bitmap &operator=(const mark_bitmap &) = delete;
+        ~mark_bitmap();
+
+        // makes sure the address is covered, has to be called before p is marked (mutator only)
+        void ensure(const void *p);
+
+        // sets the mark bit, returns true only for the thread which actually set it
+        bool try_mark(const void *p)
+        {
+            word *w = leaf(p);
+            if (!w)
+                return false;
+            std::uint64_t b = bit(p);
+            w += word_index(p);
+            if (w->load(std::memory_order_relaxed) & b)
+                return false;
+            return !(w->fetch_or(b, std::memory_order_relaxed) & b);
+        }
+        // try_mark() without the locked read-modify-write, only while no other thread marks
+        bool mark_alone(const void *p)
+        {
+            word *w = leaf(p);
+            if (!w)
+                return false;
+            std::uint64_t b = bit(p);
+            w += word_index(p);
+            std::uint64_t bits = w->load(std::memory_order_relaxed);
+            if (bits & b)
+                return false;
+            w->store(bits | b, std::memory_order_relaxed);
+            return true;
+        }
+        bool is_marked(const void *p) const
+        {
+            word *w = leaf(p);
+            return w && (w[word_index(p)].load(std::memory_order_relaxed) & bit(p));
+        }
+
+        // whether anything in the 64 KiB the address belongs to is marked
+        bool any(const void *p) const
+        {
+            word *w = leaf(p);
+            std::uint64_t bits = 0;
+            for (int i = 0; w && i < leaf_words; i++)
+                bits |= w[i].load(std::memory_order_relaxed);
+            return bits != 0;
+        }
+
+        // unmarks everything (no marking may be in progress)
+        void clear();
+        // unmarks the 64 KiB the address belongs to
+        void clear(const void *p);
+    };
+
+    // Chase-Lev work-stealing deque of objects waiting to be traced
+    // the owning worker pushes and pops at the bottom without locks, other workers steal from the top
+    // the ring is bounded, once full push() spills the oldest half to gc::packets (see gc::refill)
+    class mark_deque
+    {
+    private:
+        struct ring
+        {
+            long capacity;
+            std::atomic<gc_object *> *slots;
+
+            explicit ring(long capacity) : capacity(capacity), slots(new std::atomic<gc_object *>[capacity]) {}
+            ~ring() { delete[] slots; }
+
+            gc_object *get(long i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+            void put(long i, gc_object *object) { slots[i & (capacity - 1)].store(object, std::memory_order_relaxed); }
+        };
+
+        alignas(64) std::atomic<long> top{0};
+        alignas(64) std::atomic<long> bottom{0};
+        std::atomic<ring *> array;
+
+        // rings replaced by grow() are kept until release_retired(), a thief may still be reading them
+        std::vector<ring *> retired;
+
+        ring *grow(ring *old, long b, long t);
+
+    public:
+        // 512 KiB of slots per deque
+        static constexpr long max_capacity = 1 << 16;
+
+        mark_deque() : array(new ring(1024)) {}
+        mark_deque(const mark_deque &) = delete;
+        mark_deque &operator=(const mark_deque &) = delete;
+        ~mark_deque();
+
+        // owner only
+        void push(gc_object *object)
+        {
+            long b = bottom.load(std::memory_order_relaxed);
+            long t = top.load(std::memory_order_acquire);
+            ring *a = array.load(std::memory_order_relaxed);
+            if (b - t > a->capacity - 1)
+            {
+                if (a->capacity < max_capacity)
+                    a = grow(a, b, t);
+                else
+                {
+                    publish(a->capacity / 2);
+                    spills++;
+                }
+            }
+            a->put(b, object);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+
+        // owner only, returns nullptr when empty
+        gc_object *pop()
+        {
+            long b = bottom.load(std::memory_order_relaxed) - 1;
+            ring *a = array.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long t = top.load(std::memory_order_relaxed);
+
+            gc_object *object = nullptr;
+            if (t <= b)
+            {
+                object = a->get(b);
+                if (t == b)
+                {
+                    // last element, race against thieves
+                    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                        object = nullptr;
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                }
+            }
+            else
+                bottom.store(b + 1, std::memory_order_relaxed);
+            return object;
+        }
+
+        // pop() for a deque nobody steals from (gc::step_deque), without the fence against thieves
+        gc_object *pop_unshared()
+        {
+            long b = bottom.load(std::memory_order_relaxed);
+            if (b == top.load(std::memory_order_relaxed))
+                return nullptr;
+            gc_object *object = array.load(std::memory_order_relaxed)->get(b - 1);
+            bottom.store(b - 1, std::memory_order_relaxed);
+            return object;
+        }
+
+        // any thread, returns nullptr when empty or when another thief won the race
+        gc_object *steal()
+        {
+            long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long b = bottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+
+            gc_object *object = array.load(std::memory_order_acquire)->get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return object;
+        }
+
+        bool empty() const
+        {
+            return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+        }
+
+        // owner only, exact unless a thief is stealing right now
+        long size() const
+        {
+            return bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed);
+        }
+
+        // owner only, moves the oldest count objects to gc::packets, there must be at least that many
+        void publish(long count);
+
+        // only while no thread is marking
+        void release_retired();
+    };
+
+    // arena page, 64 KiB aligned so the header is found by masking an object's address
+    // small pages hold slots of one size class, objects above the largest class get a block of their own (mapped
+    // straight from the OS, see map_large)
+    struct page
+    {
+        static constexpr std::size_t size = 1 << 16;
+        static constexpr std::uint32_t large_class = 0xff;
+
+        page *next = nullptr;
+        char *first = nullptr;
+        // holds gc_leaf_objects, which are marked but never traced
+        bool leaf = false;
+
+        std::uint32_t object_size = 0;
+        std::uint32_t capacity = 0;
+        // slots in use, and the first slot that was never handed out
+        std::uint32_t used = 0;
+        std::uint32_t bump = 0;
+        // (offset * reciprocal) >> 32 == offset / object_size for every offset inside the page
+        std::uint64_t reciprocal = 0;
+        std::uint32_t size_class = 0;
+
+        // freed slots, linked through their first word
+        void *free_list = nullptr;
+        page *next_available = nullptr;
+
+        // lazy sweeping: the page still holds the marks of the last collection and has not been swept,
+        // claimed is set while a thread that took it off the unswept list sweeps it (under heap_mutex)
+        bool needs_sweep = false;
+        bool claimed = false;
+        page *next_unswept = nullptr;
+
+        // one bit per slot in use
+        std::uint64_t allocated[size / 16 / 64] = {};
+        // slots allocated since the allocating thread's last safepoint (see gc::forget_fresh), and the
+        // mutators whose fresh_pages list the page; only the page's current owner sets bits
+        std::uint64_t fresh[size / 16 / 64] = {};
+        std::uint32_t fresh_holders = 0;
+        // slots whose object needs no destructor call (see gc_trivial_destructor), freed without one
+        std::uint64_t trivial[size / 16 / 64] = {};
+        // slots whose object may be moved by compaction (see gc_relocatable)
+        std::uint64_t relocatable[size / 16 / 64] = {};
+        // compaction is moving the live objects out, the first word of a moved one points to its copy
+        bool evacuating = false;
+
+        // slots the finalizer thread destroyed while a mutator was allocating from the page, they go
+        // back to free_list once the mutator gives the page up
+        void *finalized = nullptr;
+        std::uint32_t finalized_count = 0;
+
+        // generational collection (collect_minor): old slots, the number of minor collections young ones
+        // survived (two bit planes) and the remembered set, i.e. old objects that may point to young ones
+        // and young ones stored into a field outside the heap
+        std::uint64_t old[size / 16 / 64] = {};
+        std::uint64_t age_low[size / 16 / 64] = {};
+        std::uint64_t age_high[size / 16 / 64] = {};
+        std::uint64_t remembered[size / 16 / 64] = {};
+        bool in_nursery = false;
+        bool in_remembered = false;
+
+        // some mutator allocates from the page (it is one of its thread-local allocation buffers)
+        bool in_use = false;
+
+        // bytes from the header on, more than size only for large objects
+        std::size_t span = size;
+
+        static page *of(const void *p)
+        {
+            return reinterpret_cast<page *>(reinterpret_cast<std::uintptr_t>(p) & ~(std::uintptr_t(size) - 1));
+        }
+        std::uint32_t slot_index(const void *p) const
+        {
+            return static_cast<std::uint32_t>(((static_cast<const char *>(p) - first) * reciprocal) >> 32);
+        }
+    };
+
+    // slots start on a cache line, so the ones of 32 and 64 bytes never straddle two
+    static constexpr std::size_t page_header_size = (sizeof(page) + 63) & ~std::size_t(63);
+
+    // the page covering each 64 KiB of the heap, tells the generational barrier whether (and in which
+    // object) a field lives in the heap
+    class page_table
+    {
+    private:
+        static constexpr int region_shift = 16;
+        static constexpr int table_bits = 16;
+
+        page **top[1 << table_bits] = {};
+
+    public:
+        page_table() {}
+        page_table(const page_table &) = delete;
+        page_table &operator=(const page_table &) = delete;
+        ~page_table();
+
+        page *find(const void *p) const
+        {
+            std::uintptr_t a = reinterpret_cast<std::uintptr_t>(p);
+            page **second = top[(a >> (region_shift + table_bits)) & ((1 << table_bits) - 1)];
+            if (!second)
+                return nullptr;
+            return second[(a >> region_shift) & ((1 << table_bits) - 1)];
+        }
+        // maps (or with nullptr unmaps) every region of the page
+        void set(page *p, page *value);
+    };
+    static page_table page_map;
+
+    struct size_class_heap
+    {
+        page *pages = nullptr;
+        page *last = nullptr;
+        // pages the last sweep left with free slots, and not in use by a mutator
+        page *available = nullptr;
+        // lazy sweeping: pages marked by the last collection that allocation has not swept yet
+        page *unswept = nullptr;
+    };
+
+    static constexpr int size_class_count = 35;
+    // gc_leaf_objects get pages of their own, heaps[size_class_count + c] holds the leaf pages of class c
+    static constexpr int heap_count = 2 * size_class_count;
+    static size_class_heap heaps[heap_count];
+    static page *large_pages;
+    static bool sweep_pending;
+
+    // guards the page lists shared between the mutators and the background sweeper (pages, available,
+    // unswept, large pages), the allocation fast path only touches the thread's own pages and never takes it
+    static std::mutex heap_mutex;
+    static std::condition_variable sweeper_condition;
+    static std::condition_variable sweep_done_condition;
+    static std::thread sweeper;
+    static bool sweeper_stop;
+    static bool large_sweep_pending;
+    static std::size_t unswept_pages;
+    static int sweeps_in_flight;
+    static int next_unswept_class;
+
+    // a thread using the collector: its roots and the page it allocates from in every size class
+    struct mutator;
+    static thread_local mutator *self;
+    static thread_local gc_handle_table *handle_table;
+    static std::vector<mutator *> mutators;
+    static std::vector<gc_root_list *> root_lists;
+
+    // safepoints: a collecting thread sets safepoint_requested and waits until every other registered
+    // mutator is parked (in safepoint() or the allocation slow path) or in a blocking region
+    static std::mutex world_mutex;
+    static std::condition_variable world_condition;
+    static std::condition_variable resume_condition;
+    static std::atomic<bool> safepoint_requested;
+    static bool world_stopped;
+    static std::thread::id world_owner;
+    static int world_depth;
+    static int parked;
+
+    static mutator *current_mutator();
+    static gc_root_list *thread_roots();
+    static gc_handle_table *thread_handles()
+    {
+        if (!handle_table)
+            register_thread();
+        return handle_table;
+    }
+    static void stop_the_world();
+    static void start_the_world();
+    static void park(std::unique_lock<std::mutex> &lock);
+    static void park_here();
+    // objects a thread allocated since its last safepoint() (or collection it asked for) may be held in
+    // locals only, e.g. by the constructor of an object that allocates: every collection keeps them
+    // until then, forget_fresh() ends the thread's window
+    static void forget_fresh();
+    static void forget_fresh(mutator *m);
+    static gc_object *fresh_target(const void *word);
+
+    // keeps the other mutators stopped for its lifetime, nests on the thread that stopped them
+    class stopped_world
+    {
+    public:
+        stopped_world() { stop_the_world(); }
+        ~stopped_world() { start_the_world(); }
+        stopped_world(const stopped_world &) = delete;
+        stopped_world &operator=(const stopped_world &) = delete;
+    };
+
+    static page *new_page(std::uint32_t size_class);
+    static void *allocate(std::size_t size);
+    static void *allocate_leaf(std::size_t size);
+    static void *allocate_small(mutator *m, std::uint32_t size_class);
+    static void *allocate_slow(mutator *m, std::uint32_t size_class);
+    static void *allocate_large(std::size_t size, bool leaf);
+    static void *map_large(std::size_t bytes);
+    static void unmap_large(page *p);
+    static std::size_t sweep_page(page *p, std::vector<void *> *deferred = nullptr);
+    static void deallocate(void *object);
+    static std::size_t sweep();
+    static std::size_t sweep_large(std::vector<void *> *deferred = nullptr);
+    static std::size_t release_empty_pages();
+    static void defer_sweep();
+    static page *claim_unswept();
+    static void sweep_now(page *p, std::unique_lock<std::mutex> &lock);
+    // the page sweep_page() runs destructors of on this thread, one of them deleting an object of the
+    // same page must not wait for the sweep to end
+    static thread_local page *sweeping_here;
+    static void sweeper_loop();
+    static void stop_sweeper();
+
+    // finalizer thread (options::finalizer): the pause leaves the objects it finds dead allocated but
+    // unlinked in dead_objects, the thread runs their destructors and returns the slots in batches
+    static std::mutex finalizer_mutex;
+    static std::condition_variable finalizer_condition;
+    static std::condition_variable finalized_condition;
+    static std::thread finalizer;
+    static std::vector<void *> dead_objects;
+    static std::vector<void *> finalizer_queue;
+    static bool finalizer_busy;
+    static bool finalizer_stop;
+    static void start_finalizer();
+    static void finalizer_loop();
+    static void release_finalized(const std::vector<void *> &slots);
+    static void reclaim_finalized(page *p);
+    static void wait_finalizer();
+    static void stop_finalizer();
+
+    template <typename T, typename... Args>
+    friend T *gc_new(Args &&...args);
+    static void set_trivial(const void *object)
+    {
+        page *p = page::of(object);
+        std::uint32_t index = p->slot_index(object);
+        p->trivial[index / 64] |= std::uint64_t(1) << (index % 64);
+    }
+    static void set_relocatable(const void *object)
+    {
+        page *p = page::of(object);
+        if (p->size_class == page::large_class)
+            return;
+        std::uint32_t index = p->slot_index(object);
+        p->relocatable[index / 64] |= std::uint64_t(1) << (index % 64);
+    }
+
+    // pointer layout of a type declared with GC_TRACE, found through the object's vtable pointer: bit i of
+    // words is set if the i-th word of the object is a pointer field (T * or gc_member_ptr<T>)
+    static constexpr int max_layout_words = 512;
+    static constexpr int descriptor_slots = 256;
+    struct type_descriptor
+    {
+        std::atomic<const void *> vtable{nullptr};
+        bool unbarriered = false;
+        std::uint32_t word_count = 0;
+        std::uint64_t words[max_layout_words / 64] = {};
+    };
+    // open addressing on the vtable pointer, entries are only added (under descriptors_mutex)
+    static type_descriptor descriptors[descriptor_slots];
+    static std::atomic<int> described_types;
+    static std::mutex descriptors_mutex;
+    static int descriptor_hash(const void *vtable)
+    {
+        return int((reinterpret_cast<std::uintptr_t>(vtable) * 0x9e3779b97f4a7c15) >> 56) & (descriptor_slots - 1);
+    }
+    static const type_descriptor *descriptor_of(const gc_object *object)
+    {
+        if (!described_types.load(std::memory_order_relaxed))
+            return nullptr;
+        const void *vtable = *reinterpret_cast<const void *const *>(object);
+        int i = descriptor_hash(vtable);
+        for (int probes = 0; probes < descriptor_slots; probes++)
+        {
+            const void *key = descriptors[i].vtable.load(std::memory_order_acquire);
+            if (key == vtable)
+                return &descriptors[i];
+            if (!key)
+                return nullptr;
+            i = (i + 1) & (descriptor_slots - 1);
+        }
+        return nullptr;
+    }
+    // fields holds (offset from the object, size) of every pointer field, types whose fields do not fit
+    // the layout (or a full table) keep being traced through trace()
+    static void describe_type(const gc_object *object, const std::pair<std::ptrdiff_t, std::size_t> *fields, std::size_t count, bool unbarriered);
+
+public:
+    // handed to gc_object::trace, user types report each of their pointer fields to it:
+    //     void trace(gc::tracer &t) override { t(left); t(right); }
+    // the per-edge work (mark bit, push, prefetch) is inlined into the caller
+    class tracer
+    {
+    private:
+        friend class gc;
+        friend class gc_object;
+        friend class gc_array_base;
+
+        static constexpr int max_prefetch = 16;
+
+        mark_deque *own = nullptr;
+        std::size_t marked = 0;
+
+        // minor collections stop at old objects and count the young ones reported, unbarriered is set
+        // when the traced object reported a raw pointer field (which changes without a barrier)
+        bool minor = false;
+        // compaction traces with this set, every edge then goes to gc::relocate instead
+        bool compacting = false;
+        bool unbarriered = false;
+        // set by gc::trace_serially, nobody else marks then so the mark bits need no atomics
+        bool alone = false;
+        std::size_t young_refs = 0;
+
+        // children found while tracing one object, pushed in reverse afterwards (see gc::mark_loop)
+        int count = 0;
+        gc_object *children[64];
+
+        // popped objects wait in this FIFO while their first line is prefetched and are traced when they
+        // leave it, most edges point to a random cache line and tracing right away would stall on it
+        int depth = prefetch_depth;
+        int queued = 0;
+        int head = 0;
+        gc_object *queue[max_prefetch];
+
+        // queues the object, returns the one it displaced (or the object itself with prefetching off),
+        // nullptr while the FIFO is filling up
+        gc_object *prefetched(gc_object *object)
+        {
+            if (!depth)
+                return object;
+            __builtin_prefetch(object);
+            if (queued < depth)
+            {
+                queue[(head + queued++) % max_prefetch] = object;
+                return nullptr;
+            }
+            gc_object *ready = queue[head];
+            queue[(head + depth) % max_prefetch] = object;
+            head = (head + 1) % max_prefetch;
+            return ready;
+        }
+        // the oldest queued object, nullptr once the FIFO is empty
+        gc_object *take_prefetched()
+        {
+            if (!queued)
+                return nullptr;
+            gc_object *ready = queue[head];
+            head = (head + 1) % max_prefetch;
+            queued--;
+            return ready;
+        }
+
+        void visit(gc_object *object)
+        {
+            if (!object)
+                return;
+            if (minor)
+            {
+                if (is_old(object))
+                    return;
+                young_refs++;
+            }
+            if (!(alone ? marks.mark_alone(object) : marks.try_mark(object)))
+                return;
+            marked++;
+            if (!scanned(object))
+                return;
+            if (depth)
+                __builtin_prefetch(object);
+            if (count < 64)
+                children[count++] = object;
+            else
+                own->push(object);
+        }
+
+        // a pointer word of a described object
+        void slot(gc_object **field)
+        {
+            if (compacting)
+            {
+                *field = relocate(*this, *field, true);
+                return;
+            }
+            visit(__atomic_load_n(field, __ATOMIC_ACQUIRE));
+        }
+        // 64 consecutive pointer words (a pointer array), runs of null pointers are skipped four at a time
+        void dense(gc_object **field)
+        {
+            for (int i = 0; i < 64; i += 4)
+            {
+                gc_object *a = __atomic_load_n(field + i, __ATOMIC_RELAXED);
+                gc_object *b = __atomic_load_n(field + i + 1, __ATOMIC_RELAXED);
+                gc_object *c = __atomic_load_n(field + i + 2, __ATOMIC_RELAXED);
+                gc_object *d = __atomic_load_n(field + i + 3, __ATOMIC_RELAXED);
+                if (!(reinterpret_cast<std::uintptr_t>(a) | reinterpret_cast<std::uintptr_t>(b) |
+                      reinterpret_cast<std::uintptr_t>(c) | reinterpret_cast<std::uintptr_t>(d)))
+                    continue;
+                for (int j = 0; j < 4; j++)
+                    slot(field + i + j);
+            }
+        }
+        // pointer arrays (gc_array) longer than array_chunk are traced a chunk at a time: the chunks after the
+        // first go to the deque as entries of their own (the address of their first element with the low bit
+        // set), which other workers steal like objects; minor collections count the young references of each
+        // remembered object and compaction updates in place, both trace the whole array at once
+        static constexpr std::size_t array_chunk = 1024;
+        void range(gc_object **words, std::size_t length)
+        {
+            for (; length >= 64; length -= 64, words += 64)
+                dense(words);
+            for (; length; length--, words++)
+                slot(words);
+        }
+        void array(gc_object **words, std::size_t length)
+        {
+            if (length > array_chunk && !minor && !compacting)
+            {
+                // in reverse, so the owner pops them in order
+                for (std::size_t start = (length - 1) / array_chunk * array_chunk; start; start -= array_chunk)
+                    own->push(reinterpret_cast<gc_object *>(reinterpret_cast<std::uintptr_t>(words + start) | 1));
+                length = array_chunk;
+            }
+            range(words, length);
+        }
+        inline void chunk(gc_object **words);
+
+        // traces the object through its pointer layout if its type has one, through trace() otherwise
+        const void *last_vtable = nullptr;
+        const type_descriptor *last_descriptor = nullptr;
+        __attribute__((always_inline)) inline void scan(gc_object *object);
+
+        // pushes the buffered children in reverse except the first one, which is returned to be traced next
+        gc_object *flush()
+        {
+            if (!count)
+                return nullptr;
+            while (count > 1)
+                own->push(children[--count]);
+            count = 0;
+            return children[0];
+        }
+
+    public:
+        tracer() {}
+        tracer(const tracer &) = delete;
+        tracer &operator=(const tracer &) = delete;
+
+        template <typename T>
+        void operator()(T *&field)
+        {
+            static_assert(std::is_base_of<gc_object, T>::value, "T must derive from gc_object!");
+            if (compacting)
+            {
+                field = static_cast<T *>(relocate(*this, field, true));
+                return;
+            }
+            unbarriered = true;
+            visit(field);
+        }
+        template <typename T>
+        void operator()(gc_member_ptr<T> &field)
+        {
+            if (compacting)
+            {
+                field.pt.store(static_cast<T *>(relocate(*this, field.pt.load(std::memory_order_relaxed), true)), std::memory_order_relaxed);
+                return;
+            }
+            visit(field.pt.load(std::memory_order_acquire));
+        }
+        // the field cannot be updated, so compaction leaves the object where it is
+        void operator()(gc_object *object)
+        {
+            if (compacting)
+            {
+                relocate(*this, object, false);
+                return;
+            }
+            visit(object);
+        }
+        template <typename F, std::size_t N>
+        void operator()(F (&fields)[N])
+        {
+            for (F &field : fields)
+                (*this)(field);
+        }
+
+        // what GC_TRACE expands trace() to: reports the fields, the first call on an object of exactly T
+        // also registers their layout (a derived type may call this trace() and report more fields)
+        template <typename T, typename... F>
+        void fields(T *object, F &...members)
+        {
+            static std::atomic<bool> described{false};
+            if (!described.load(std::memory_order_acquire) && typeid(*object) == typeid(T))
+            {
+                const char *base = reinterpret_cast<const char *>(static_cast<const gc_object *>(object));
+                std::pair<std::ptrdiff_t, std::size_t> layout[] = {{reinterpret_cast<const char *>(&members) - base, sizeof(F)}...};
+                bool raw = (std::is_pointer<typename std::remove_all_extents<F>::type>::value || ...);
+                describe_type(object, layout, sizeof...(F), raw);
+                described.store(true, std::memory_order_release);
+            }
+            ((*this)(members), ...);
+        }
+    };
+
+private:
+    static std::condition_variable threadpool_condition;
+    static std::condition_variable end_of_task_condition;
+
+    static std::mutex threadpool_mutex;
+    static std::mutex wait_mutex;
+
+    static std::vector<std::thread> pool;
+    static std::vector<mark_deque *> deques;
+    static mark_bitmap marks;
+
+    static int hw_threads;
+    static bool terminate_pool;
+    static bool stopped;
+    static int sleeping_workers;
+    static bool spin_workers;
+    // copies of config.spin and config.prefetch the workers read, configure() rewrites config while
+    // a concurrent cycle is marking
+    static std::chrono::microseconds spin_time;
+    static int prefetch_depth;
+
+    // what the pool runs when pool_epoch is bumped
+    enum class pool_task
+    {
+        mark,
+        sweep
+    };
+    static pool_task task;
+    static std::atomic<unsigned long> pool_epoch;
+    static std::atomic<int> running_workers;
+    // when the current task was handed out, and the longest a worker took to pick one up since
+    // the last collection started
+    static std::chrono::steady_clock::time_point pool_start;
+    static std::atomic<long long> longest_wake;
+
+    // lock-free termination: marking is over once every worker is idle with an empty deque
+    static std::atomic<int> idle_markers;
+    static std::atomic<std::size_t> marked_objects;
+
+    // incremental (collect_step) and concurrent (start_concurrent_collect) marking: the write barrier of
+    // gc_member_ptr logs overwritten pointers while marking_active (snapshot-at-the-beginning),
+    // objects allocated meanwhile are born marked
+    enum class cycle_kind
+    {
+        none,
+        incremental,
+        concurrent
+    };
+    static cycle_kind cycle;
+    static std::atomic<bool> marking_active;
+    static mark_deque step_deque;
+
+    // work packets: objects spilled by full mark stacks or published by a worker while others are idle,
+    // handed out packet_size at a time to whoever runs out of work
+    static constexpr long packet_size = 256;
+    static std::mutex packets_mutex;
+    static std::vector<gc_object *> packets;
+    static std::atomic<bool> packets_available;
+    static bool refill(mark_deque &into);
+
+    // per cycle, moved to last_stats by take_mark_counts()
+    static std::atomic<std::size_t> spills;
+    static std::vector<std::size_t> worker_marked;
+    static void take_mark_counts();
+    static std::chrono::steady_clock::time_point cycle_start;
+    // marked_objects when the pool last started on a concurrent cycle, tells how much its round traced
+    static std::size_t round_start;
+    static std::mutex satb_mutex;
+    static std::vector<gc_object *> satb_buffer;
+
+    static void satb_log(gc_object *old);
+    static bool drain_satb(mark_deque &into);
+    static void write_barrier(gc_object *old)
+    {
+        if (old && marking_active.load(std::memory_order_relaxed))
+            satb_log(old);
+    }
+
+    // weak references: gc_weak_ptrs and the entries of gc_weak_maps do not keep their objects alive,
+    // process_weak() runs once marking is complete and clears the ones left pointing to dead objects
+    static std::mutex weak_mutex;
+    static gc_weak_ptr_base *weak_ptrs;
+    static std::vector<gc_weak_map_base *> weak_maps;
+    static void process_weak();
+
+    // compaction (options::compact_threshold): after the marking of a collect(), the live objects of
+    // sparse pages are copied to fresh pages in depth-first order from the roots, and every reference
+    // the tracer can update is redirected to the copy; relocation_marks first holds the objects that
+    // must not move (a by-value edge points to them), then the ones the evacuation has reached
+    static mark_bitmap relocation_marks;
+    static bool pinning;
+    static page *evacuation_targets[heap_count];
+    static void compact();
+    static gc_object *relocate(tracer &t, gc_object *object, bool updatable);
+    static gc_object *evacuate(gc_object *object);
+    // an object read through a weak reference while a cycle is marking may have no marked path to it,
+    // it is logged like an overwritten pointer so the cycle keeps it
+    static void keep_alive(gc_object *object)
+    {
+        write_barrier(object);
+    }
+
+    // generational collection: switched on by the first collect_minor(), from then on the barrier of
+    // gc_member_ptr remembers old objects that get a pointer to a young one
+    static bool generational;
+    static bool minor_cycle;
+    static int promotion_age;
+    static std::vector<page *> nursery_pages;
+    static std::vector<page *> remembered_pages;
+
+    // gc_leaf_objects are only marked, never pushed to a mark stack
+    static bool scanned(const gc_object *object)
+    {
+        return !page::of(object)->leaf;
+    }
+
+    static bool is_old(const void *object)
+    {
+        const page *p = page::of(object);
+        std::uint32_t index = p->slot_index(object);
+        return (p->old[index / 64] >> (index % 64)) & 1;
+    }
+    static void remember_object(const void *object);
+    static void remember(const void *field, gc_object *value);
+    static void generational_barrier(const void *field, gc_object *value)
+    {
+        if (generational && value)
+            remember(field, value);
+    }
+    // the traced object reported raw pointer fields, which change without the barrier: survivors of a
+    // full collection become old, so these have to stay in the remembered set
+    static void note_unbarriered(tracer &t, gc_object *object)
+    {
+        t.unbarriered = false;
+        if (generational && !t.minor)
+            remember_object(object);
+    }
+    static void enter_nursery(page *p);
+    static void forget_page(page *p);
+    static std::uint64_t age_survivors(page *p, std::uint32_t w, std::uint64_t young, std::uint64_t survivors, std::size_t &promoted);
+    static bool sweep_young(page *p, std::size_t &freed, std::size_t &promoted, std::vector<void *> *deferred);
+    static void reset_generations();
+    // marked, or left alone by the minor collection in progress
+    static bool survives(const gc_object *object)
+    {
+        return marks.is_marked(object) || (minor_cycle && is_old(object));
+    }
+
+    // parallel sweep hands out chunks of sweep_pages through next_sweep_page
+    static std::vector<page *> sweep_pages;
+    static std::atomic<std::size_t> next_sweep_page;
+    static std::atomic<std::size_t> swept_objects;
+
+    static std::size_t mark_roots(mark_deque **into, int count);
+    static void finish_cycle(std::chrono::steady_clock::time_point sweep_start);
+    static void abandon_cycle();
+    static void trace_serially(tracer &t, std::size_t budget, bool &done);
+    static void mark_loop(int index);
+    static gc_object *steal_job(int index);
+    static bool work_available(int index);
+    static void sweep_loop();
+    static void run_pool(pool_task what);
+    static void start_pool(pool_task what);
+    static void wait_pool();
+    static void threadpool_loop(int index);
+    static void terminate_threads();
+
+public:
+    enum class sweep_mode
+    {
+        // sweep on the thread calling collect()
+        serial,
+        // split the pages between the pool threads, destructors then run concurrently
+        parallel,
+        // collect() only marks, a page is swept when the allocator first needs memory from it
+        // (or by finish_sweep()), so destructors run later on the allocating thread
+        lazy,
+        // collect() only marks, a background thread sweeps while the mutator keeps running
+        concurrent
+    };
+
+    // in lazy and concurrent mode sweep_time only covers the leftover pages collect() swept before marking, and freed_objects is 0
+    struct statistics
+    {
+        // for collect_step cycles mark_time is the sum of the steps and longest_step the longest of them,
+        // for concurrent cycles mark_time is the wall time from the snapshot to the end of the remark
+        std::chrono::nanoseconds mark_time{0};
+        std::chrono::nanoseconds sweep_time{0};
+        std::chrono::nanoseconds longest_step{0};
+        std::size_t mark_steps = 0;
+        // stop-the-world parts of a concurrent cycle, and the objects the final remark marked
+        std::chrono::nanoseconds snapshot_time{0};
+        std::chrono::nanoseconds remark_time{0};
+        std::size_t remark_objects = 0;
+        // for collect_minor only the young objects are counted
+        std::size_t live_objects = 0;
+        std::size_t freed_objects = 0;
+        std::size_t promoted_objects = 0;
+        // of the freed objects, those left to the finalizer thread
+        std::size_t finalized_objects = 0;
+        // longest time from handing a task to the pool until a worker started it
+        std::chrono::nanoseconds wake_latency{0};
+        // whether collect() or collect_minor() marked on the calling thread instead of the pool
+        bool serial_mark = false;
+        // how often a full mark stack spilled half of itself to the work packets
+        std::size_t mark_stack_spills = 0;
+        // objects each pool worker marked (the roots are not counted), empty if the pool did not mark
+        std::vector<std::size_t> marked_per_worker;
+        // gc_weak_ptrs cleared and gc_weak_map entries dropped because their object was not reachable
+        std::size_t weak_cleared = 0;
+        // fraction of free slots in the small object pages after marking, and the objects compaction
+        // moved (only measured by collect() with compaction on)
+        double fragmentation = 0;
+        std::size_t relocated_objects = 0;
+        std::chrono::nanoseconds compact_time{0};
+    };
+
+    // who marks in collect() and collect_minor(), incremental cycles always mark on the calling thread
+    // and concurrent ones on the pool
+    enum class marking_mode
+    {
+        // the calling thread while the heap is small (see options::serial_threshold) or the pool has
+        // a single worker, the pool otherwise
+        adaptive,
+        serial,
+        parallel
+    };
+
+    // runtime configuration, the environment variable named next to a field overrides it
+    struct options
+    {
+        // pool size (GC_THREADS), 0 means one worker per cpu the process may use, which honours the
+        // affinity mask and the cgroup cpu quota of containers
+        int threads = 0;
+        // pins worker i to cpus[i % cpus.size()] if not empty (Linux only)
+        std::vector<int> cpus;
+        // idle workers spin this long before they go to sleep (if there is more than one cpu)
+        std::chrono::microseconds spin{50};
+        // GC_MARKING: adaptive, serial or parallel
+        marking_mode marking = marking_mode::adaptive;
+        // adaptive marking stays on the calling thread while both the previous collection's live objects
+        // and the current roots are fewer than this (GC_SERIAL_THRESHOLD)
+        std::size_t serial_threshold = 10000;
+        // objects popped off the mark stack are prefetched and traced this many pops later, at most 16
+        // (GC_PREFETCH); off by default, it only pays when objects lie in memory in another order than
+        // they are reached, e.g. nodes linked up in random order
+        int prefetch = 0;
+        // GC_SWEEP_MODE: serial, parallel, lazy or concurrent
+        sweep_mode sweep = sweep_mode::serial;
+        // serial and parallel sweeps (and minor collections) leave the destructors to a finalizer thread,
+        // the next collection waits for it, destructors must not allocate then (GC_FINALIZER=1)
+        bool finalizer = false;
+        // minor collections a young object survives before it is promoted, 1 to 4 (GC_PROMOTION_AGE)
+        int promotion_age = 2;
+        // allocation runs collect() once the heap has grown to heap_growth times its size after the last
+        // collection (but at least 4 MiB), 0 leaves collecting to the program (GC_HEAP_GROWTH)
+        // such a collection keeps what the allocating thread allocated since its last safepoint (see
+        // safepoint()), so constructors may allocate and n = new Node(42); n->right = new Node(24); is fine
+        double heap_growth = 0;
+        // collect() compacts when more than this fraction of the slots in the small object pages is free,
+        // moving the objects of the pages at least as sparse; 0 turns compaction off (GC_COMPACT_THRESHOLD)
+        // only gc_relocatable objects move, and only the references the tracer can update (gc_root_ptr,
+        // gc_handle, weak references, fields reported as gc_member_ptr or T *&) are redirected, so
+        // other pointers to them must not be kept across collect(); not done in generational mode
+        double compact_threshold = 0;
+    };
+
+private:
+    static sweep_mode sweeping;
+    static statistics last_stats;
+    static options config;
+    // configure() writes config with the world stopped, the collector reads it from there too,
+    // configuration() only takes this lock to copy it
+    static std::mutex config_mutex;
+
+    // heap growth policy: bytes of pages currently held, and the size that triggers the next collection
+    static std::atomic<std::size_t> heap_bytes;
+    static std::atomic<std::size_t> collect_at;
+    // stop_the_world nesting on this thread, a thread that stopped the world does not collect again
+    static thread_local int world_held;
+
+    static void update_collect_at();
+    static void maybe_collect();
+    // collect() without ending the calling thread's allocation window, for the growth policy
+    static void collect_full();
+    // objects the last collection (full or minor) marked, used to choose who marks the next one
+    static std::size_t previous_live;
+    // workers the pool has or would have, 0 until mark_serially() needs it
+    static int pool_size;
+    static bool mark_serially(std::size_t roots);
+    static void mark_from_roots();
+
+public:
+    gc() {}
+    // applies the options, with the environment variables overriding them, a running pool is restarted
+    // if its shape changed; the environment alone is applied when the program starts
+    static void configure(const options &requested);
+    static options configuration();
+    // starts the worker pool, it stays up until shutdown() (or the end of the program); without it the
+    // first collection starts the pool
+    static void init();
+    static void init(const options &requested);
+    // joins the pool and the background sweeper and abandons a cycle in progress, the next collection
+    // starts them again
+    static void shutdown();
+    static void start_threadpool();
+    static void collect();
+
+    // incremental collection: advances marking by at most budget traced objects and returns true once
+    // the cycle is complete and swept (according to the sweep mode), a new cycle starts on the next call
+    // sound only if pointer fields that change while a cycle is running are gc_member_ptr
+    // collect() abandons a cycle in progress
+    static bool collect_step(std::size_t budget);
+
+    // mostly-concurrent collection: start_concurrent_collect() snapshots the roots and lets the pool trace
+    // while the caller keeps running, concurrent_collect_poll() returns true once the cycle is complete
+    // and swept; when the pool is done it traces the pointers logged by the barrier concurrently again
+    // until there are few of them and they led to little, then runs the final remark on the calling
+    // thread, which hands the rest back to the pool if it would have to trace more than a few thousand
+    // needs the same gc_member_ptr fields as collect_step, and trace() has to tolerate concurrent
+    // assignments to them (i.e. no containers that the mutator reallocates)
+    static void start_concurrent_collect();
+    static bool concurrent_collect_poll();
+    // blocks until the concurrent cycle in progress is complete
+    static void finish_concurrent_collect();
+
+    // generational collection: collects only the young objects, i.e. the ones allocated since they last
+    // survived a collection, tracing from the roots and the remembered set instead of the whole heap;
+    // an object that survives promotion_age minor collections, and every survivor of a full collection,
+    // becomes old and is only reclaimed by collect() (or its incremental and concurrent forms) again
+    // the first call traces everything and switches the collector to generational mode, from then on
+    // the sweep modes lazy and concurrent sweep in collect() like serial
+    // old-to-young edges are found through the barrier of gc_member_ptr, objects reporting raw pointer
+    // fields (get_ptrs, or T * fields passed to the tracer) are rescanned by every minor collection
+    // a young object stored into a gc_member_ptr outside the heap (a container's buffer, a local) has no
+    // owner to rescan, it stays alive until it is promoted
+    static void collect_minor();
+    // shorthand for configure() with only the promotion age changed
+    static void set_promotion_age(int cycles);
+
+    // threads register themselves when they first allocate or create a gc_root_ptr and unregister when
+    // they exit, the roots they leave behind stay roots; collections stop every registered thread at
+    // a safepoint: the allocation slow path, safepoint(), or anywhere inside a blocking region
+    // so do the background sweeper and the finalizer thread if a destructor they run allocates or
+    // creates a root, and as they wait for work outside any safepoint the next collection would wait
+    // for them forever: destructors must not do either in those modes
+    static void register_thread();
+    static void unregister_thread();
+    // what a thread allocated stays alive, reachable from a root or not, until the thread next calls
+    // safepoint() (or collect(), collect_minor(), collect_step() or start_concurrent_collect()), so a
+    // constructor may allocate and a new object may sit in a local while other threads collect; call
+    // it where everything the thread still needs is rooted (never inside a constructor), and now and
+    // then in a thread that runs for long without allocating
+    static void safepoint()
+    {
+        forget_fresh();
+        if (safepoint_requested.load(std::memory_order_acquire))
+            park_here();
+    }
+    // between the two the thread must not touch collected objects or roots, collections do not wait
+    // for it; wrap anything that waits on another thread in one (join, contended locks, blocking I/O)
+    static void enter_blocking();
+    static void leave_blocking();
+
+    // shorthand for configure() with only the sweep mode changed
+    static void set_sweep_mode(sweep_mode mode);
+    // sweeps every page lazy sweeping has left behind, or waits for the background sweeper to finish
+    static void finish_sweep();
+    // timings and object counts of the last collect()
+    static statistics last_statistics();
+};
+class gc_object : gc_object_base
+{
+    friend class gc;
+
+public:
+    gc_object();
+    gc_object(const gc_object &);
+    gc_object(gc_object &&) = delete; // move constructor is actually never called (copy constructor is called instead)
+    gc_object &operator=(const gc_object &);
+    gc_object &operator=(const gc_object &&) = delete; // move assignment is actually never called (copy constructor is called instead)
+    ~gc_object();
+
+    // every gc_object is allocated in the collector's arenas, gc_object must be the first base of T
+    // a destructor may delete another unreachable object only while that one is not destroyed yet
+    // (it lies later on the same page or was deleted by nobody else), the sweep then leaves it to the delete
+    static void *operator new(std::size_t size) { return gc::allocate(size); }
+    static void operator delete(void *object) { gc::deallocate(object); }
+
+protected:
+    virtual void get_ptrs(std::function<void(gc_object *)>) {}
+
+    // reports every pointer field to the tracer, the default forwards the pointers from get_ptrs
+    virtual void trace(gc::tracer &t);
+};
+static_assert(sizeof(gc_object) == sizeof(void *), "the vtable pointer is the only per-object header");
+
+inline void gc::tracer::scan(gc_object *object)
+{
+    if (reinterpret_cast<std::uintptr_t>(object) & 1)
+    {
+        chunk(reinterpret_cast<gc_object **>(reinterpret_cast<std::uintptr_t>(object) - 1));
+        return;
+    }
+    // most objects are of the type traced just before
+    const void *vtable = *reinterpret_cast<const void *const *>(object);
+    const type_descriptor *d = last_descriptor;
+    if (vtable != last_vtable)
+    {
+        d = descriptor_of(object);
+        last_vtable = vtable;
+        last_descriptor = d;
+    }
+    if (!d)
+    {
+        object->trace(*this);
+        return;
+    }
+    if (d->unbarriered)
+        unbarriered = true;
+    gc_object **words = reinterpret_cast<gc_object **>(object);
+    for (std::uint32_t i = 0; i < d->word_count; i++, words += 64)
+    {
+        std::uint64_t bits = d->words[i];
+        if (bits == ~std::uint64_t(0))
+        {
+            dense(words);
+            continue;
+        }
+        while (bits)
+        {
+            slot(words + __builtin_ctzll(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+// declares trace() for a type whose pointer fields are the listed members (T *, gc_member_ptr<T> or
+// arrays of them), which must all be pointer-aligned words of the object:
+//     class Node : public gc_object { ... GC_TRACE(Node, left, right) };
+// after the first trace() marking reads the fields through the type's layout without the virtual call
+#define GC_TRACE(type, ...)                                \
+    void trace(gc::tracer &t) override                     \
+    {                                                      \
+        t.fields(static_cast<type *>(this), __VA_ARGS__); \
+    }
+
+// specialize as std::true_type for types whose destructor has nothing to do (no ~T of their own and no
+// members or bases other than gc_object that need destroying, gc_member_ptr fields are fine), gc_new
+// then tags the object and the sweep frees it without calling the destructor
+template <typename T>
+struct gc_trivial_destructor : std::false_type
+{
+};
+
+// specialize as std::true_type for types compaction may move with a plain memcpy: no pointers into the
+// object itself and no members that register their address (gc_root_ptr, gc_weak_ptr, gc_weak_map,
+// std::string with its inline buffer...); gc_new then tags the object
+template <typename T>
+struct gc_relocatable : std::false_type
+{
+};
+
+// allocates a T in the collector's arenas
+template <typename T, typename... Args>
+T *gc_new(Args &&...args)
+{
+    static_assert(std::is_base_of<gc_object, T>::value, "T must derive from gc_object!");
+    T *object = new T(std::forward<Args>(args)...);
+    if (gc_trivial_destructor<T>::value)
+        gc::set_trivial(object);
+    if (gc_relocatable<T>::value)
+        gc::set_relocatable(object);
+    return object;
+}
+
+// base of pointer-free types (strings, numbers, blobs): they are allocated in leaf pages of their own, and
+// marking sets their mark bit without ever tracing (or touching) them
+class gc_leaf_object : public gc_object
+{
+public:
+    static void *operator new(std::size_t size) { return gc::allocate_leaf(size); }
+    static void operator delete(void *object) { gc::deallocate(object); }
 
-class gc_object_base
+protected:
+    void trace(gc::tracer &) final {}
+};
+
+// byte buffer of any length in the leaf space, above 8 KiB its bytes start on a 4 KiB boundary and can be
+// handed to read()/write() (or O_DIRECT I/O) as they are
+class gc_bytes final : public gc_leaf_object
 {
 private:
-    friend class gc_object;
+    std::size_t length;
+
+    explicit gc_bytes(std::size_t length) : length(length) {}
+
+public:
+    static gc_bytes *create(std::size_t length)
+    {
+        gc_bytes *bytes = ::new (gc::allocate_leaf(sizeof(gc_bytes) + length)) gc_bytes(length);
+        gc::set_trivial(bytes);
+        return bytes;
+    }
+
+    char *data()
+    {
+        return reinterpret_cast<char *>(this + 1);
+    }
+    const char *data() const
+    {
+        return reinterpret_cast<const char *>(this + 1);
+    }
+    std::size_t size() const
+    {
+        return length;
+    }
+};
+static_assert(sizeof(gc_bytes) == 16, "allocate_large() aligns the bytes after a 16 byte header");
+
+// the part of gc_array the tracer needs to find the end of a chunked array
+class gc_array_base : public gc_object
+{
+protected:
     friend class gc;
 
-    // indicates if object should be deleted when sweeping
-    bool reachability_flag = false;
+    std::size_t length;
 
-    // prev & next for gc_object's list
-    gc_object_base *prev = nullptr;
-    gc_object_base *next = nullptr;
+    explicit gc_array_base(std::size_t length) : length(length) {}
 
-    // static head & tail for gc_object's list
-    static gc_object_base head_obj;
-    static gc_object_base *actual_obj;
+    gc_object **words()
+    {
+        return reinterpret_cast<gc_object **>(this + 1);
+    }
 
-public:
-    virtual ~gc_object_base() {}
+    void trace(gc::tracer &t) override
+    {
+        t.array(words(), length);
+    }
 };
 
+inline void gc::tracer::chunk(gc_object **words)
+{
+    // only arrays above max_small_size are chunked, the page is the array's large page
+    gc_array_base *array = reinterpret_cast<gc_array_base *>(page_map.find(words)->first);
+    std::size_t left = array->words() + array->length - words;
+    range(words, left < array_chunk ? left : array_chunk);
+}
 
-class gc_object : gc_object_base
+// pointer field of a gc_object with a write barrier, needed by incremental marking and generational collection
+// reads are plain loads, assignments log the overwritten pointer while a marking cycle is running
+// and, in generational mode, remember the object holding the field if it is old and the new one young
+template <typename T>
+class gc_member_ptr
 {
+private:
     friend class gc;
 
+    // atomic because concurrent markers read it while the mutator assigns (plain moves on x86)
+    std::atomic<T *> pt{nullptr};
+
 public:
-    gc_object();
-    gc_object(const gc_object &);
-    gc_object(gc_object &&) = delete; // move constructor is actually never called (copy constructor is called instead)
-    gc_object &operator=(const gc_object &);
-    gc_object &operator=(const gc_object &&) = delete; // move assignment is actually never called (copy constructor is called instead)
-    ~gc_object();
+    gc_member_ptr() {}
+    gc_member_ptr(T *p) : pt(p)
+    {
+        gc::generational_barrier(this, p);
+    }
+    gc_member_ptr(const gc_member_ptr &other) : pt(other.get())
+    {
+        gc::generational_barrier(this, get());
+    }
+    // dropping the field (e.g. erasing it from a container) deletes an edge as well
+    ~gc_member_ptr()
+    {
+        gc::write_barrier(get());
+    }
+    gc_member_ptr &operator=(T *p)
+    {
+        gc::write_barrier(get());
+        pt.store(p, std::memory_order_release);
+        gc::generational_barrier(this, p);
+        return *this;
+    }
+    gc_member_ptr &operator=(const gc_member_ptr &other)
+    {
+        return *this = other.get();
+    }
 
-protected:
-    virtual void get_ptrs(std::function<void(gc_object *)>) {}
+    T *operator->() const
+    {
+        return get();
+    }
+    T &operator*() const
+    {
+        return *get();
+    }
+    // acquire pairs with the release in operator=, an object handed to another thread through a field
+    // is seen constructed
+    T *get() const
+    {
+        return pt.load(std::memory_order_acquire);
+    }
+    operator T *() const
+    {
+        return get();
+    }
+};
+
+// fixed length array of pointers, e.g. gc_array<Node *>, with its elements inline (a large one gets a large
+// page of its own); the elements are gc_member_ptrs, and marking splits long arrays into chunks so several
+// workers trace them at once:
+//     gc_array<Node *> *nodes = gc_array<Node *>::create(1 << 20);
+//     (*nodes)[i] = gc_new<Node>(i);
+template <typename T>
+class gc_array;
+
+template <typename T>
+class gc_array<T *> final : public gc_array_base
+{
+    static_assert(std::is_base_of<gc_object, T>::value, "T must derive from gc_object!");
+
+private:
+    explicit gc_array(std::size_t length) : gc_array_base(length)
+    {
+        for (std::size_t i = 0; i < length; i++)
+            ::new (begin() + i) gc_member_ptr<T>();
+    }
+
+public:
+    // the elements need no destructor call, the array is freed without one
+    static gc_array *create(std::size_t length)
+    {
+        gc_array *array = ::new (gc::allocate(sizeof(gc_array) + length * sizeof(gc_member_ptr<T>))) gc_array(length);
+        gc::set_trivial(array);
+        return array;
+    }
+
+    gc_member_ptr<T> &operator[](std::size_t i)
+    {
+        return begin()[i];
+    }
+    T *operator[](std::size_t i) const
+    {
+        return begin()[i].get();
+    }
+    std::size_t size() const
+    {
+        return length;
+    }
+    gc_member_ptr<T> *begin()
+    {
+        return reinterpret_cast<gc_member_ptr<T> *>(this + 1);
+    }
+    gc_member_ptr<T> *end()
+    {
+        return begin() + length;
+    }
+    const gc_member_ptr<T> *begin() const
+    {
+        return reinterpret_cast<const gc_member_ptr<T> *>(this + 1);
+    }
+    const gc_member_ptr<T> *end() const
+    {
+        return begin() + length;
+    }
 };
 
 class gc_root_ptr_base
@@ -55,174 +1457,386 @@ class gc_root_ptr_base
     template <typename>
     friend class gc_root_ptr;
     friend class gc;
+    friend struct gc_root_list;
 
     gc_object *gc_object_pointer = nullptr;
 
-    // prev & next for gc_root_ptr's list
+    // prev & next for gc_root_ptr's list, and the list (of the thread that created the root)
     gc_root_ptr_base *prev = nullptr;
     gc_root_ptr_base *next = nullptr;
+    gc_root_list *list = nullptr;
 
-    // static head & tail for gc_root_ptr's list
-    static gc_root_ptr_base head_root;
-    static gc_root_ptr_base *actual_root;
+    void link();
+    void unlink();
 };
 
-class gc
+// roots of one thread, the lock is only contended when a root is destroyed by another thread
+struct gc_root_list
 {
-private:
-    template <typename T>
-    friend class gc_root_ptr;
-
-    static std::condition_variable threadpool_condition;
-    static std::condition_variable end_of_marking_condition;
+    std::mutex lock;
+    // static head & tail for gc_root_ptr's list
+    gc_root_ptr_base head_root;
+    gc_root_ptr_base *actual_root = &head_root;
+    // the thread exited with roots left, the first collection that finds the list empty frees it
+    bool orphaned = false;
+};
 
-    static std::mutex shutdown_mutex;
-    static std::mutex add_job_mutex;
-    static std::mutex threadpool_mutex;
-    static std::mutex wait_mutex;
+// one thread's handles: chunks of root slots filled like a stack, a gc_handle_scope gives back
+// every slot taken since it opened, the collector scans the chunks as plain arrays
+struct gc_handle_table
+{
+    static constexpr std::size_t chunk_size = 1024;
 
-    static std::vector<std::thread> pool;
-    static std::queue<gc_object *> queue;
+    std::vector<gc_object **> chunks;
+    // chunk being filled, the ones before it are full
+    std::size_t chunk = 0;
+    gc_object **next = nullptr;
+    gc_object **limit = nullptr;
 
-    static int hw_threads;
-    static bool terminate_pool;
-    static bool stopped;
+    gc_object **add(gc_object *object)
+    {
+        if (next == limit)
+            grow();
+        *next = object;
+        return next++;
+    }
+    void grow();
+    ~gc_handle_table();
+};
 
-    static std::atomic<int> thread_finish_counter;
-    static std::atomic<int> job_counter;
-    static std::atomic<int> fork_counter;
+inline void gc_root_ptr_base::link()
+{
+    list = gc::thread_roots();
+    std::unique_lock<std::mutex> guard(list->lock);
+    prev = list->actual_root;
+    list->actual_root->next = this;
+    list->actual_root = this;
+    next = nullptr;
+}
 
-    static void callback(gc_object *object);
-    static void threadpool_loop();
-    static void add_job(gc_object *New_Job);
-    static void terminate_threads();
+inline void gc_root_ptr_base::unlink()
+{
+    std::unique_lock<std::mutex> guard(list->lock);
+    if (list->actual_root == this)
+    {
+        list->actual_root = prev;
+    }
+    if (prev)
+    {
+        prev->next = next;
+    }
+    if (next)
+    {
+        next->prev = prev;
+    }
+}
 
-public:
-    gc() {}
-    static void start_threadpool();
-    static void collect();
-};
 template <typename T>
 class gc_root_ptr : gc_root_ptr_base
 {
-private:
-    T *pt = nullptr;
-
 public:
     gc_root_ptr()
     {
-        prev = actual_root;
-        actual_root->next = this;
-        actual_root = this;
+        link();
     }
     gc_root_ptr(const gc_root_ptr &other)
     {
-        if (!actual_root)
-        {
-            actual_root = &head_root;
-        }
         if (DEBUG)
             std::cout << "copy constructor" << std::endl;
-        pt = other.pt;
         gc_object_pointer = other.gc_object_pointer;
-        prev = actual_root;
-        actual_root->next = this;
-        actual_root = this;
+        link();
     }
     gc_root_ptr(gc_root_ptr &&other)
     {
-        if (!actual_root)
-        {
-            actual_root = &head_root;
-        }
-
-        pt = other.pt;
         gc_object_pointer = other.gc_object_pointer;
-        prev = actual_root;
-        actual_root->next = this;
-        actual_root = this;
-        other.pt = nullptr;
+        link();
         other.gc_object_pointer = nullptr;
     }
     gc_root_ptr &operator=(const gc_root_ptr &other)
     {
         if (DEBUG)
             std::cout << "copy assignment" << std::endl;
-        pt = other.pt;
         gc_object_pointer = other.gc_object_pointer;
         return *this;
     }
     gc_root_ptr &operator=(gc_root_ptr &&other)
     {
-        pt = other.pt;
         gc_object_pointer = other.gc_object_pointer;
-        other.pt = nullptr;
         other.gc_object_pointer = nullptr;
         return *this;
     }
     gc_root_ptr(T *p)
     {
         static_assert(std::is_base_of<gc_object, T>::value, "T must derive from gc_object!");
-        if (!actual_root)
-        {
-            actual_root = &head_root;
-        }
         gc_object_pointer = (gc_object *)p;
-        pt = p;
-
-        prev = actual_root;
-        actual_root->next = this;
-        actual_root = this;
-        next = nullptr;
+        link();
     }
     ~gc_root_ptr()
     {
         if (DEBUG)
             std::cout << "gc_root_ptr Destructor" << std::endl;
 
-        if (actual_root == this)
-        {
-            actual_root = prev;
-        }
-        if (prev)
-        {
-            prev->next = next;
-        }
-        if (next)
-        {
-            next->prev = prev;
-        }
-        if (&head_root == actual_root)
-            gc::terminate_threads();
+        unlink();
     }
     T *operator->() const
     {
-        return pt;
+        return get();
     }
     T &operator*() const
     {
-        return *pt;
+        return *get();
     }
 
+    // the pointer is only kept as gc_object_pointer, which compaction may rewrite
     T *get() const
     {
-        return this->pt;
+        return static_cast<T *>(this->gc_object_pointer);
     }
     void reset(T *ptr = nullptr)
     {
         if (!ptr && DEBUG)
             std::cout << "ptr is NULL!" << std::endl;
-        this->pt = ptr;
         this->gc_object_pointer = (gc_object *)ptr;
     }
     explicit operator bool() const
     {
-        if (pt)
+        if (gc_object_pointer)
             return true;
         return false;
     }
 };
 
+// releases all handles created on this thread since it was opened at once, scopes nest like blocks
+// handles created outside any scope live until the thread exits
+class gc_handle_scope
+{
+private:
+    gc_handle_table *table;
+    std::size_t chunk;
+    gc_object **next;
+    gc_object **limit;
+
+public:
+    gc_handle_scope() : table(gc::thread_handles()), chunk(table->chunk), next(table->next), limit(table->limit)
+    {
+    }
+    ~gc_handle_scope()
+    {
+        table->chunk = chunk;
+        table->next = next;
+        table->limit = limit;
+    }
+    gc_handle_scope(const gc_handle_scope &) = delete;
+    gc_handle_scope &operator=(const gc_handle_scope &) = delete;
+};
+
+// root held by the innermost gc_handle_scope of the creating thread, creating one is a store into the
+// handle table and copies share the slot; it must not outlive its scope or leave the thread
+template <typename T>
+class gc_handle
+{
+private:
+    gc_object **slot = nullptr;
+
+public:
+    gc_handle() {}
+    gc_handle(T *p) : slot(gc::thread_handles()->add(p))
+    {
+        static_assert(std::is_base_of<gc_object, T>::value, "T must derive from gc_object!");
+    }
+
+    T *operator->() const
+    {
+        return get();
+    }
+    T &operator*() const
+    {
+        return *get();
+    }
+    T *get() const
+    {
+        return slot ? static_cast<T *>(*slot) : nullptr;
+    }
+    explicit operator bool() const
+    {
+        return get() != nullptr;
+    }
+};
+
+// base of gc_weak_ptr, every weak pointer is on the gc::weak_ptrs list
+class gc_weak_ptr_base
+{
+private:
+    friend class gc;
+
+    gc_weak_ptr_base *prev = nullptr;
+    gc_weak_ptr_base *next = nullptr;
+
+    void link();
+    void unlink();
+
+protected:
+    // only a collection (with the world stopped) clears it
+    std::atomic<gc_object *> target;
+
+    explicit gc_weak_ptr_base(gc_object *object) : target(object)
+    {
+        link();
+    }
+    ~gc_weak_ptr_base()
+    {
+        unlink();
+    }
+
+    gc_object *load() const
+    {
+        gc_object *object = target.load(std::memory_order_acquire);
+        gc::keep_alive(object);
+        return object;
+    }
+};
+
+inline void gc_weak_ptr_base::link()
+{
+    std::unique_lock<std::mutex> guard(gc::weak_mutex);
+    next = gc::weak_ptrs;
+    if (next)
+        next->prev = this;
+    gc::weak_ptrs = this;
+}
+
+inline void gc_weak_ptr_base::unlink()
+{
+    std::unique_lock<std::mutex> guard(gc::weak_mutex);
+    if (prev)
+        prev->next = next;
+    else
+        gc::weak_ptrs = next;
+    if (next)
+        next->prev = prev;
+}
+
+// pointer that does not keep its object alive, it reads as nullptr once a collection found the object
+// unreachable (before the object is destroyed); it may live anywhere, also inside collected objects,
+// whose trace() does not report it
+template <typename T>
+class gc_weak_ptr : gc_weak_ptr_base
+{
+public:
+    gc_weak_ptr(T *p = nullptr) : gc_weak_ptr_base(p)
+    {
+        static_assert(std::is_base_of<gc_object, T>::value, "T must derive from gc_object!");
+    }
+    gc_weak_ptr(const gc_weak_ptr &other) : gc_weak_ptr_base(other.get()) {}
+    gc_weak_ptr &operator=(const gc_weak_ptr &other)
+    {
+        reset(other.get());
+        return *this;
+    }
+    gc_weak_ptr &operator=(T *p)
+    {
+        reset(p);
+        return *this;
+    }
+
+    T *operator->() const
+    {
+        return get();
+    }
+    T &operator*() const
+    {
+        return *get();
+    }
+    T *get() const
+    {
+        return static_cast<T *>(load());
+    }
+    void reset(T *p = nullptr)
+    {
+        target.store(p, std::memory_order_release);
+    }
+    explicit operator bool() const
+    {
+        return get() != nullptr;
+    }
+};
+
+// base of gc_weak_map, every map is on the gc::weak_maps list
+class gc_weak_map_base
+{
+private:
+    friend class gc;
+
+protected:
+    std::unordered_map<gc_object *, gc_object *> entries;
+
+    gc_weak_map_base()
+    {
+        std::unique_lock<std::mutex> guard(gc::weak_mutex);
+        gc::weak_maps.push_back(this);
+    }
+    ~gc_weak_map_base()
+    {
+        std::unique_lock<std::mutex> guard(gc::weak_mutex);
+        for (std::size_t i = 0; i < gc::weak_maps.size(); i++)
+        {
+            if (gc::weak_maps[i] == this)
+            {
+                gc::weak_maps[i] = gc::weak_maps.back();
+                gc::weak_maps.pop_back();
+                break;
+            }
+        }
+    }
+    gc_weak_map_base(const gc_weak_map_base &) = delete;
+    gc_weak_map_base &operator=(const gc_weak_map_base &) = delete;
+};
+
+// ephemeron table: an entry keeps its value alive only while the key is reachable through something
+// other than the map, and is dropped once a collection finds the key unreachable, so a value may point
+// to its own key (or to the keys of other entries) without keeping anything alive
+// like the standard containers it has to be locked by the program if several threads use it
+template <typename K, typename V>
+class gc_weak_map : gc_weak_map_base
+{
+public:
+    gc_weak_map()
+    {
+        static_assert(std::is_base_of<gc_object, K>::value, "K must derive from gc_object!");
+        static_assert(std::is_base_of<gc_object, V>::value, "V must derive from gc_object!");
+    }
+
+    void set(K *key, V *value)
+    {
+        entries[key] = value;
+    }
+    // the value stored for key, nullptr if there is none
+    V *get(K *key) const
+    {
+        auto it = entries.find(key);
+        if (it == entries.end())
+            return nullptr;
+        gc::keep_alive(it->second);
+        return static_cast<V *>(it->second);
+    }
+    bool contains(K *key) const
+    {
+        return entries.count(key) != 0;
+    }
+    void erase(K *key)
+    {
+        entries.erase(key);
+    }
+    void clear()
+    {
+        entries.clear();
+    }
+    std::size_t size() const
+    {
+        return entries.size();
+    }
+};
+
 #endif
 
 // g++ -o main -std=c++17  -Wall -Wextra -Wpedantic -pthread gc.cpp recodex_main.cpp && ./main 6
\ No newline at end of file
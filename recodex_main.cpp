@@ -1,8 +1,17 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <functional>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
 #include "gc.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
 #include <string>
 
 class Node : public gc_object
@@ -367,6 +376,998 @@ void test6()
     std::cout << std::endl;
 }
 
+// Mark throughput with and without prefetching (nothing is freed, the trees stay reachable)
+void markBenchmark(const char *name)
+{
+    for (int depth : {0, 8})
+    {
+        gc::options o = gc::configuration();
+        o.prefetch = depth;
+        gc::configure(o);
+
+        std::chrono::nanoseconds best = std::chrono::nanoseconds::max();
+        for (int i = 0; i < 5; i++)
+        {
+            gc::collect();
+            best = std::min(best, gc::last_statistics().mark_time);
+        }
+        double ms = best.count() / 1e6;
+        std::cout << name << ", prefetch " << depth << ": " << ms << "ms, "
+                  << gc::last_statistics().live_objects / ms / 1000 << " Mobjects/s" << std::endl;
+    }
+}
+
+// the tree of test6
+void test7()
+{
+    const int maxElements = (1 << 23) - 1;
+
+    BinaryTree tree;
+    tree.addBalancedRange(1, maxElements);
+    markBenchmark("balanced");
+}
+
+// keys inserted in random order, the nodes of a subtree end up scattered over the heap (smaller than
+// test6, building it is slow)
+void test8()
+{
+    const int maxElements = (1 << 21) - 1;
+
+    std::vector<int> keys(maxElements);
+    for (int i = 0; i < maxElements; i++)
+        keys[i] = i + 1;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(6));
+
+    BinaryTree tree;
+    for (int key : keys)
+        tree.add(key);
+    markBenchmark("shuffled");
+}
+
+// pair of raw pointers whose destructor has nothing to do, so dead pages of them are freed in bulk
+class Pair : public gc_object
+{
+public:
+    Pair *next{nullptr};
+    Node *node{nullptr};
+
+    GC_TRACE(Pair, next, node)
+};
+template <>
+struct gc_trivial_destructor<Pair> : std::true_type
+{
+};
+
+// generational mode: a page freed in bulk by collect() must not leave old bits behind for the next
+// objects placed in it
+void test9()
+{
+    gc::collect_minor();
+
+    gc_root_ptr<Pair> list;
+    for (int i = 0; i < 10000; i++)
+    {
+        Pair *p = gc_new<Pair>();
+        p->next = list.get();
+        list = p;
+    }
+    gc::collect(); // the pairs are old now
+    list.reset();
+    gc::collect(); // their pages are freed in bulk
+
+    gc_root_ptr<Pair> root = gc_new<Pair>();
+    root->node = new Node(1);
+    gc::collect_minor(); // Nothing, the new pair is young and traced
+    std::cout << root->node->val << std::endl;
+
+    root.reset();
+    gc::collect(); // "Deleted: 1"
+}
+
+// node that compaction may move: its pointer fields are reported through GC_TRACE, which lets the tracer
+// update them
+class Key : public gc_object
+{
+public:
+    int val;
+    Key *left{nullptr};
+    Key *right{nullptr};
+
+    Key(int val) : val(val) {}
+
+    GC_TRACE(Key, left, right)
+};
+template <>
+struct gc_relocatable<Key> : std::true_type
+{
+};
+template <>
+struct gc_trivial_destructor<Key> : std::true_type
+{
+};
+
+Key *buildKeys(int from, int to)
+{
+    if (from > to)
+        return nullptr;
+    int middle = (from + to) / 2;
+    Key *k = gc_new<Key>(middle);
+    k->left = buildKeys(from, middle - 1);
+    k->right = buildKeys(middle + 1, to);
+    return k;
+}
+
+void dropLeaves(Key *k)
+{
+    if (k->left && !k->left->left && !k->left->right)
+        k->left = nullptr;
+    else if (k->left)
+        dropLeaves(k->left);
+    if (k->right && !k->right->left && !k->right->right)
+        k->right = nullptr;
+    else if (k->right)
+        dropLeaves(k->right);
+}
+
+void collectKeys(Key *k, std::vector<int> &keys)
+{
+    if (!k)
+        return;
+    collectKeys(k->left, keys);
+    keys.push_back(k->val);
+    collectKeys(k->right, keys);
+}
+
+// compaction: the leaves were allocated in between the inner nodes, dropping them leaves every page half
+// empty and collect() moves the rest together
+void test10()
+{
+    gc::options o = gc::configuration();
+    o.compact_threshold = 0.25;
+    gc::configure(o);
+
+    const int maxElements = (1 << 16) - 1;
+    gc_root_ptr<Key> tree = buildKeys(1, maxElements);
+    gc_root_ptr<Key> two = tree.get();
+    while (two->val != 2)
+        two = two->val > 2 ? two->left : two->right;
+
+    gc_handle_scope scope;
+    gc_handle<Key> four = tree->left;
+    while (four->val != 4)
+        four = gc_handle<Key>(four->val > 4 ? four->left : four->right);
+
+    dropLeaves(tree.get());
+    gc::collect();
+    std::cout << (gc::last_statistics().relocated_objects > 0 ? "OK" : "KO") << std::endl;
+
+    // every odd key was a leaf
+    std::vector<int> keys;
+    collectKeys(tree.get(), keys);
+    bool intact = keys.size() == maxElements / 2;
+    for (std::size_t i = 0; intact && i < keys.size(); i++)
+        intact = keys[i] == 2 * int(i + 1);
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+
+    // the roots and handles point to the moved objects
+    Key *k = tree.get();
+    while (k->val != 2)
+        k = k->val > 2 ? k->left : k->right;
+    std::cout << (k == two.get() && two->val == 2 ? "OK" : "KO") << std::endl;
+    std::cout << (four->val == 4 && four->left == two.get() ? "OK" : "KO") << std::endl;
+}
+
+// list node with a barriered field, assignments to it are seen by the generational and incremental collectors
+class Link : public gc_object
+{
+public:
+    int val;
+    gc_member_ptr<Link> next;
+
+    Link(int val) : val(val) {}
+
+    ~Link()
+    {
+        std::cout << "Deleted:" << val << std::endl;
+    }
+
+    GC_TRACE(Link, next)
+};
+
+// generational collection: promotion after promotion_age minor collections, and an old object keeping
+// a young one alive through the remembered set
+void test11()
+{
+    gc::set_promotion_age(2);
+
+    gc_root_ptr<Link> a = new Link(1);
+    new Link(2);
+    gc::collect_minor(); // "Deleted: 2"
+    std::cout << gc::last_statistics().promoted_objects << std::endl; // 0
+    gc::collect_minor(); // Nothing
+    std::cout << gc::last_statistics().promoted_objects << std::endl; // 1
+
+    // a is old, the roots do not lead to its new child, only the barrier of the field does
+    a->next = new Link(3);
+    gc::collect_minor(); // Nothing
+    std::cout << a->next->val << std::endl;
+
+    a.reset();
+    gc::collect_minor(); // Nothing, minor collections leave old objects (and what they point to) alone
+    std::cout << "After GC" << std::endl;
+
+    gc::collect(); // "Deleted: 1", "Deleted: 3"
+    std::cout << gc::last_statistics().promoted_objects << std::endl; // 0
+}
+
+void printLinks(Link *l)
+{
+    for (; l; l = l->next)
+        std::cout << l->val << " ";
+    std::cout << std::endl;
+}
+
+// incremental marking: the mutator moves objects between fields while a cycle is running
+void test12()
+{
+    gc_root_ptr<Link> head = new Link(1);
+    Link *last = head.get();
+    for (int i = 2; i <= 10; i++)
+    {
+        last->next = new Link(i);
+        last = last->next;
+    }
+
+    gc::collect_step(1); // the head has been traced
+
+    // 6..10 move from a field the marker has not reached yet behind the traced head, the barrier logs
+    // the pointers overwritten on the way
+    Link *five = head->next->next->next->next;
+    Link *six = five->next;
+    five->next = nullptr;
+    head->next = six;
+    // allocated during the cycle, born marked
+    last->next = new Link(11);
+
+    while (!gc::collect_step(1))
+    {
+    }
+    // Nothing, 2..5 were reachable when the cycle started
+    printLinks(head.get()); // 1 6 7 8 9 10 11
+
+    gc::collect(); // "Deleted: 2", "Deleted: 3", "Deleted: 4", "Deleted: 5"
+    printLinks(head.get()); // 1 6 7 8 9 10 11
+}
+
+// mostly-concurrent marking: the list is rearranged and grown while the pool traces it
+void test13()
+{
+    const int count = 2000;
+    const int rotations = 100;
+
+    gc_root_ptr<Link> head = new Link(1);
+    Link *last = head.get();
+    for (int i = 2; i <= count; i++)
+    {
+        last->next = new Link(i);
+        last = last->next;
+    }
+    new Link(0);
+
+    gc::start_concurrent_collect();
+    std::mt19937 random(13);
+    for (int i = 0; i < rotations || !gc::concurrent_collect_poll(); i++)
+    {
+        if (i >= rotations)
+            continue;
+        // head, A, B -> head, B, A, and a new node at the end
+        Link *p = head->next;
+        for (int k = random() % (count - 2); k > 0; k--)
+            p = p->next;
+        Link *first = head->next;
+        Link *b = p->next;
+        p->next = nullptr;
+        last->next = first;
+        head->next = b;
+        p->next = new Link(count + 1 + i);
+        last = p->next;
+    }
+    gc::finish_concurrent_collect(); // "Deleted: 0"
+
+    std::vector<int> vals;
+    for (Link *l = head.get(); l; l = l->next)
+        vals.push_back(l->val);
+    std::sort(vals.begin(), vals.end());
+    bool intact = vals.size() == count + rotations;
+    for (std::size_t i = 0; intact && i < vals.size(); i++)
+        intact = vals[i] == int(i + 1);
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+
+    gc::collect(); // Nothing
+    std::cout << "After GC" << std::endl;
+}
+
+// weak pointers and ephemerons
+void test14()
+{
+    gc_root_ptr<Node> a = new Node(1);
+    gc_weak_ptr<Node> weakA = a.get();
+    gc_weak_ptr<Node> weakB = new Node(2);
+    gc::collect(); // "Deleted: 2"
+    std::cout << weakA->val << " " << (*weakA).val << std::endl;
+    std::cout << (weakB ? "KO" : "OK") << std::endl;
+
+    // the value points back to its key, the map alone keeps neither of them alive
+    gc_weak_map<Node, Node> map;
+    gc_root_ptr<Node> key = new Node(3);
+    Node *value = new Node(4);
+    value->left = key.get();
+    map.set(key.get(), value);
+    gc::collect(); // Nothing, the key is reachable
+    std::cout << map.get(key.get())->val << std::endl;
+
+    key.reset();
+    gc::collect(); // "Deleted: 3", "Deleted: 4"
+    std::cout << map.size() << std::endl;
+
+    a.reset();
+    gc::collect(); // "Deleted: 1"
+    std::cout << (weakA ? "KO" : "OK") << std::endl;
+}
+
+// several mutators allocate and hold roots while the main thread collects, they stop at their allocations,
+// at safepoint() and in blocking regions
+void test15()
+{
+    const int threads = 4;
+    const int rounds = 50;
+    const int length = 1000;
+
+    std::atomic<int> finished{0};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+                             {
+            for (int round = 0; round < rounds; round++)
+            {
+                gc_root_ptr<Key> chain;
+                for (int i = 0; i < length; i++)
+                {
+                    Key *k = gc_new<Key>(i);
+                    k->left = chain.get();
+                    chain = k;
+                    gc_new<Key>(-1);
+                }
+
+                long sum = 0;
+                for (Key *k = chain.get(); k; k = k->left)
+                {
+                    sum += k->val;
+                    gc::safepoint();
+                }
+                if (sum != long(length) * (length - 1) / 2)
+                    failures++;
+
+                gc::enter_blocking();
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                gc::leave_blocking();
+            }
+            finished++; });
+    }
+
+    int collections = 0;
+    while (finished < threads || collections == 0)
+    {
+        gc::collect();
+        collections++;
+    }
+    gc::enter_blocking();
+    for (std::thread &worker : workers)
+        worker.join();
+    gc::leave_blocking();
+
+    gc::collect();
+    std::cout << (failures == 0 ? "OK" : "KO") << std::endl;
+    std::cout << gc::last_statistics().live_objects << std::endl; // 0
+}
+
+// pointer array in a large page of its own, the parallel marker splits it into chunks
+void test16()
+{
+    gc::options o = gc::configuration();
+    o.marking = gc::marking_mode::parallel;
+    gc::configure(o);
+
+    const int length = 5000;
+    gc_root_ptr<gc_array<Key *>> keys = gc_array<Key *>::create(length);
+    for (int i = 0; i < length; i++)
+        (*keys)[i] = gc_new<Key>(i);
+    gc_new<Key>(-1);
+
+    gc::collect();
+    bool intact = true;
+    for (int i = 0; i < length; i++)
+        intact = intact && (*keys)[i]->val == i;
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+    std::cout << gc::last_statistics().live_objects << " " << gc::last_statistics().freed_objects << std::endl; // 5001 1
+
+    for (int i = 0; i < length; i += 2)
+        (*keys)[i] = nullptr;
+    gc::collect();
+    intact = true;
+    for (int i = 1; i < length; i += 2)
+        intact = intact && (*keys)[i]->val == i;
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+    std::cout << gc::last_statistics().live_objects << " " << gc::last_statistics().freed_objects << std::endl; // 2501 2500
+
+    keys.reset();
+    gc::collect();
+    std::cout << gc::last_statistics().live_objects << " " << gc::last_statistics().freed_objects << std::endl; // 0 2501
+}
+
+// handles: roots until their scope closes, more of them than fit one chunk of the handle table
+void test17()
+{
+    {
+        gc_handle_scope outer;
+        gc_handle<Node> one = new Node(1);
+        {
+            gc_handle_scope inner;
+            std::vector<gc_handle<Key>> keys;
+            for (int i = 0; i < 1500; i++)
+                keys.push_back(gc_handle<Key>(gc_new<Key>(i)));
+            gc_handle<Node> two = new Node(2);
+
+            gc::collect(); // Nothing
+            bool intact = true;
+            for (int i = 0; i < 1500; i++)
+                intact = intact && keys[i]->val == i;
+            std::cout << (intact ? "OK" : "KO") << " " << two->val << std::endl;
+        }
+
+        gc::collect(); // "Deleted: 2"
+        std::cout << gc::last_statistics().freed_objects << " " << one->val << std::endl; // 1501 1
+    }
+
+    gc::collect(); // "Deleted: 1"
+}
+
+// destructors on the finalizer thread, objects with a trivial destructor freed without one
+void test18()
+{
+    gc::options o = gc::configuration();
+    o.finalizer = true;
+    gc::configure(o);
+
+    gc_root_ptr<Node> root = new Node(1);
+    root->left = new Node(2);
+    root->right = new Node(3);
+    for (int i = 0; i < 100; i++)
+        gc_new<Key>(i);
+    new Node(4);
+
+    gc::collect(); // "Deleted: 4", on the finalizer thread
+    gc::statistics first = gc::last_statistics();
+    gc::collect(); // Nothing, waits for the finalizer first
+    std::cout << first.freed_objects << " " << first.finalized_objects << std::endl; // 101 1
+
+    root.reset();
+    gc::collect(); // "Deleted: 1", "Deleted: 2", "Deleted: 3"
+    first = gc::last_statistics();
+    gc::collect();
+    std::cout << first.freed_objects << " " << first.finalized_objects << std::endl; // 3 3
+}
+
+// test5 with a sweep mode that leaves the destructors to finish_sweep() (lazy) or to a background
+// thread (concurrent), the same nodes are deleted once finish_sweep() returns
+void sweptTest5(gc::sweep_mode mode)
+{
+    gc::set_sweep_mode(mode);
+    {
+        BinaryTree tree;
+        tree.addBalancedRange(1, 15);
+
+        for (int val : {3, 6, 12})
+        {
+            tree.detachSubtree(val);
+            gc::collect();
+            gc::finish_sweep();
+            std::cout << std::endl;
+        }
+
+        tree.detachSubtree(2);
+    }
+    gc::collect();
+    gc::finish_sweep();
+    std::cout << std::endl;
+}
+
+// lazy sweeping
+void test19()
+{
+    gc::set_sweep_mode(gc::sweep_mode::lazy);
+    new Node(100);
+    gc::collect(); // Nothing, the page is left unswept
+    std::cout << "After GC" << std::endl;
+    gc::finish_sweep(); // "Deleted: 100"
+    std::cout << std::endl;
+
+    sweptTest5(gc::sweep_mode::lazy); // the output of test5
+}
+
+// background sweeping, the sweeper thread runs the destructors
+void test20()
+{
+    sweptTest5(gc::sweep_mode::concurrent); // the output of test5
+}
+
+// allocates in its constructor: until it returns, the chains hang off the half-built object and a local
+class Forest : public gc_object
+{
+public:
+    Key *chains[4] = {};
+
+    Forest(int length)
+    {
+        for (Key *&chain : chains)
+        {
+            Key *last = nullptr;
+            for (int i = 0; i < length; i++)
+            {
+                Key *k = gc_new<Key>(i);
+                k->left = last;
+                last = k;
+                gc_new<Key>(-1);
+            }
+            chain = last;
+        }
+    }
+
+    GC_TRACE(Forest, chains)
+};
+
+// other threads collect while the constructors run, what a thread allocated since its last safepoint stays
+void test21()
+{
+    const int threads = 4;
+    const int rounds = 40;
+    const int length = 2000;
+
+    std::atomic<int> finished{0};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+                             {
+            for (int round = 0; round < rounds; round++)
+            {
+                gc_root_ptr<Forest> forest = gc_new<Forest>(length);
+                for (Key *chain : forest->chains)
+                {
+                    long sum = 0;
+                    for (Key *k = chain; k; k = k->left)
+                        sum += k->val;
+                    if (sum != long(length) * (length - 1) / 2)
+                        failures++;
+                }
+                gc::safepoint();
+            }
+            finished++; });
+    }
+
+    while (finished < threads)
+        gc::collect();
+    gc::enter_blocking();
+    for (std::thread &worker : workers)
+        worker.join();
+    gc::leave_blocking();
+
+    gc::collect();
+    std::cout << (failures == 0 ? "OK" : "KO") << std::endl;
+    std::cout << gc::last_statistics().live_objects << std::endl; // 0
+}
+
+// configure() clamps the options and the environment overrides them
+void test22()
+{
+    gc::options o = gc::configuration();
+    o.promotion_age = 0;
+    o.prefetch = -3;
+    gc::configure(o);
+    std::cout << gc::configuration().promotion_age << " " << gc::configuration().prefetch << std::endl; // 1 0
+    o.promotion_age = 9;
+    o.prefetch = 100;
+    gc::configure(o);
+    std::cout << gc::configuration().promotion_age << " " << gc::configuration().prefetch << std::endl; // 4 16
+
+    setenv("GC_THREADS", "3", 1);
+    setenv("GC_MARKING", "serial", 1);
+    setenv("GC_SWEEP_MODE", "lazy", 1);
+    setenv("GC_HEAP_GROWTH", "1.5", 1);
+    gc::configure(gc::options());
+    gc::options e = gc::configuration();
+    std::cout << e.threads << " " << (e.marking == gc::marking_mode::serial) << " " << (e.sweep == gc::sweep_mode::lazy)
+              << " " << e.heap_growth << std::endl; // 3 1 1 1.5
+
+    // unknown modes are reported and leave the option alone
+    setenv("GC_MARKING", "sideways", 1);
+    setenv("GC_SWEEP_MODE", "never", 1);
+    setenv("GC_HEAP_GROWTH", "-2", 1);
+    gc::configure(gc::options());
+    e = gc::configuration();
+    std::cout << (e.marking == gc::marking_mode::adaptive) << " " << (e.sweep == gc::sweep_mode::serial)
+              << " " << e.heap_growth << std::endl; // 1 1 0
+
+    for (const char *name : {"GC_THREADS", "GC_MARKING", "GC_SWEEP_MODE", "GC_HEAP_GROWTH"})
+        unsetenv(name);
+    gc::configure(gc::options());
+    gc::collect();
+    std::cout << gc::configuration().threads << std::endl; // 0
+}
+
+// the growth policy collects inside the constructors, the chains they build so far survive
+void test23()
+{
+    gc::options o = gc::configuration();
+    o.heap_growth = 1.0;
+    gc::configure(o);
+
+    const int length = 10000;
+    bool intact = true;
+    gc_weak_ptr<Forest> first;
+    for (int round = 0; round < 20; round++)
+    {
+        gc_root_ptr<Forest> forest = gc_new<Forest>(length);
+        if (!round)
+            first = forest.get();
+        for (Key *chain : forest->chains)
+        {
+            long sum = 0;
+            for (Key *k = chain; k; k = k->left)
+                sum += k->val;
+            intact &= sum == long(length) * (length - 1) / 2;
+        }
+        gc::safepoint();
+    }
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+    std::cout << (first.get() ? "KO" : "OK") << std::endl; // the first forest was collected
+}
+
+// a long chain that is still unmarked when the barrier logs it right after the snapshot is traced by
+// the pool, the final remark stays short
+void test24()
+{
+    const int count = 1 << 20;
+    gc_root_ptr<Link> from = new Link(-1);
+    Link *last = from.get();
+    Link *cut = nullptr;
+    for (int i = 0; i < count; i++)
+    {
+        last->next = new Link(i);
+        last = last->next;
+        if (i == count / 2)
+            cut = last;
+    }
+
+    // objects allocated while the cycle marks are born marked and never traced, so once the second
+    // half hangs from one, only the barrier log leads to it
+    gc::start_concurrent_collect();
+    gc_root_ptr<Link> to = new Link(-2);
+    to->next = cut->next;
+    cut->next = nullptr;
+    gc::finish_concurrent_collect();
+
+    int length = 0;
+    for (Link *l = from->next; l; l = l->next)
+        length++;
+    for (Link *l = to->next; l; l = l->next)
+        length++;
+    std::cout << (length == count ? "OK" : "KO") << std::endl;
+    std::cout << (gc::last_statistics().remark_objects <= 4096 ? "OK" : "KO") << std::endl;
+}
+
+// deleting an object while sweeps are pending sweeps its own page only, the other garbage waits
+void test25()
+{
+    gc::set_sweep_mode(gc::sweep_mode::lazy);
+    new Node(100);
+    Link *link = new Link(1);
+    gc_root_ptr<Link> root = link;
+    gc::collect();
+    root.reset();
+    delete link; // "Deleted:1", the page of Node 100 is still unswept
+    std::cout << "After delete" << std::endl;
+    gc::finish_sweep(); // "Deleted:100"
+}
+
+// object deleting its partner from its destructor, val 0 marks fillers that die silently
+class Owner : public gc_object
+{
+public:
+    int val;
+    Owner *partner{nullptr};
+
+    Owner(int val, Owner *partner = nullptr) : val(val), partner(partner) {}
+
+    ~Owner()
+    {
+        if (val)
+            std::cout << "Deleted:" << val << std::endl;
+        delete partner;
+    }
+
+protected:
+    void get_ptrs(std::function<void(gc_object *)> callback) override
+    {
+        callback(partner);
+    }
+};
+
+// a destructor deleting another unreachable object of the same page, in the same bitmap word and in a
+// later one: each is destroyed exactly once
+void test26()
+{
+    Owner *owner = new Owner(1);
+    owner->partner = new Owner(2);
+    owner = new Owner(3);
+    for (int i = 0; i < 200; ++i)
+        new Owner(0);
+    owner->partner = new Owner(4);
+    owner = nullptr;
+    gc::collect(); // "Deleted:1" .. "Deleted:4" once each
+    std::cout << "After collect" << std::endl;
+}
+
+// parallel sweep over pages of several size classes, with and without destructors, in leaf pages too
+void test27()
+{
+    gc::options o = gc::configuration();
+    o.threads = 4;
+    o.sweep = gc::sweep_mode::parallel;
+    gc::configure(o);
+
+    const int count = 6000;
+    gc_root_ptr<Pair> pairs;
+    gc_root_ptr<Owner> owners;
+    for (int i = 0; i < count; i++)
+    {
+        Pair *p = gc_new<Pair>();
+        p->next = pairs.get();
+        pairs = p;
+        if (i % 2)
+            owners = new Owner(0, owners.get());
+        else
+            new Owner(0);
+        gc_new<Key>(i);
+        gc_bytes::create(i % 500);
+    }
+
+    gc::collect();
+    gc::statistics s = gc::last_statistics();
+    std::cout << s.live_objects << " " << s.freed_objects << std::endl; // 9000 15000
+
+    int length = 0;
+    for (Pair *p = pairs.get(); p; p = p->next)
+        length++;
+    for (Owner *w = owners.get(); w; w = w->partner)
+        length++;
+    std::cout << length << std::endl; // 9000
+}
+
+// the pool shut down between collections, in the middle of a concurrent cycle and twice in a row, and
+// started again by the next collection or by init() with another size
+void test28()
+{
+    gc::options o = gc::configuration();
+    o.threads = 3;
+    o.marking = gc::marking_mode::parallel;
+    gc::init(o);
+
+    gc_root_ptr<Key> tree = buildKeys(1, (1 << 12) - 1);
+    gc::collect();
+    std::cout << gc::last_statistics().marked_per_worker.size() << std::endl; // 3
+
+    gc::shutdown();
+    new Node(1);
+    gc::collect(); // "Deleted:1"
+    gc::statistics s = gc::last_statistics();
+    std::cout << s.marked_per_worker.size() << " " << s.live_objects << std::endl; // 3 4095
+
+    new Node(2);
+    gc::start_concurrent_collect();
+    gc::shutdown();
+    gc::shutdown();
+    gc::collect(); // "Deleted:2"
+    std::cout << gc::last_statistics().live_objects << std::endl; // 4095
+
+    o.threads = 2;
+    gc::init(o);
+    dropLeaves(tree.get());
+    gc::collect();
+    s = gc::last_statistics();
+    std::cout << s.marked_per_worker.size() << " " << s.live_objects << " " << s.freed_objects << std::endl; // 2 2047 2048
+    gc::shutdown();
+}
+
+// adaptive marking: the calling thread marks while the previous collection found a small heap, the pool
+// once it found a large one, and always the calling thread with a single worker
+void test29()
+{
+    gc::options o = gc::configuration();
+    o.threads = 4;
+    o.serial_threshold = 1000;
+    gc::configure(o);
+
+    gc_root_ptr<Key> tree = buildKeys(1, 100);
+    gc::collect();
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 1
+
+    tree = buildKeys(1, 5000);
+    gc::collect(); // the previous collection found 100 objects
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 1
+    gc::collect();
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 0
+
+    tree = buildKeys(1, 100);
+    gc::collect(); // the previous collection found 5000 objects
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 0
+    gc::collect();
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 1
+
+    // many roots count as a large heap right away
+    std::vector<gc_root_ptr<Key>> roots;
+    for (int i = 0; i < 2000; i++)
+        roots.emplace_back(gc_new<Key>(i));
+    gc::collect();
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 0
+    roots.clear();
+
+    o.threads = 1;
+    gc::configure(o);
+    tree = buildKeys(1, 5000);
+    gc::collect();
+    gc::collect();
+    std::cout << gc::last_statistics().serial_mark << std::endl; // 1
+}
+
+// four chains of half a million keys, each key with a leaf beside the next link, marked by a pool of four:
+// every worker follows a chain of its own and the leaves it leaves behind outgrow its bounded mark stack,
+// which spills to the overflow list instead of growing
+void test30()
+{
+    gc::options o = gc::configuration();
+    o.threads = 4;
+    o.marking = gc::marking_mode::parallel;
+    gc::configure(o);
+
+    const int count = 1 << 19;
+    std::vector<gc_root_ptr<Key>> chains(4);
+    for (gc_root_ptr<Key> &chain : chains)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            Key *k = gc_new<Key>(i);
+            k->left = chain.get();
+            k->right = gc_new<Key>(-1);
+            chain = k;
+        }
+    }
+    gc::collect();
+    gc::statistics s = gc::last_statistics();
+    std::cout << s.live_objects << " " << (s.mark_stack_spills > 0 ? "OK" : "KO") << std::endl; // 4194304 OK
+
+    bool intact = true;
+    for (gc_root_ptr<Key> &chain : chains)
+    {
+        long sum = 0;
+        for (Key *k = chain.get(); k; k = k->left)
+            sum += k->val + k->right->val;
+        intact &= sum == long(count) * (count - 1) / 2 - count;
+    }
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+}
+
+// the objects the pool workers marked add up to the live objects less the roots, which are marked before
+// the pool starts; the calling thread marking alone leaves the counts empty
+void test31()
+{
+    gc::options o = gc::configuration();
+    o.threads = 3;
+    o.marking = gc::marking_mode::parallel;
+    gc::configure(o);
+
+    std::vector<gc_root_ptr<Key>> trees;
+    for (int size : {1, 100, 20000, 70000})
+    {
+        trees.emplace_back(buildKeys(1, size));
+        gc::collect();
+        gc::statistics s = gc::last_statistics();
+        std::size_t sum = 0;
+        for (std::size_t n : s.marked_per_worker)
+            sum += n;
+        std::cout << s.marked_per_worker.size() << " " << (sum + trees.size() == s.live_objects ? "OK" : "KO")
+                  << std::endl; // "0 OK" (a lone root leaves the workers nothing), then "3 OK" three times
+    }
+
+    o.marking = gc::marking_mode::serial;
+    gc::configure(o);
+    gc::collect();
+    std::cout << gc::last_statistics().marked_per_worker.size() << std::endl; // 0
+}
+
+// leaf object with a pointer the collector never sees: leaves are marked, not traced
+class Blob : public gc_leaf_object
+{
+public:
+    Node *node{nullptr};
+};
+
+// leaf objects: large byte buffers start on a 4 KiB boundary, their bytes and fields are never read by
+// marking (the data of one is made inaccessible across a collection), and dead leaves are freed
+void test32()
+{
+    gc_root_ptr<gc_array<gc_bytes *>> buffers = gc_array<gc_bytes *>::create(5);
+    std::size_t lengths[] = {1, 100, 8193, 20000, 1 << 20};
+    bool aligned = true;
+    for (int i = 0; i < 5; i++)
+    {
+        gc_bytes *b = gc_bytes::create(lengths[i]);
+        std::fill(b->data(), b->data() + b->size(), char(i));
+        (*buffers)[i] = b;
+        if (lengths[i] > 8192)
+            aligned &= reinterpret_cast<std::uintptr_t>(b->data()) % 4096 == 0;
+    }
+    std::cout << (aligned ? "OK" : "KO") << std::endl;
+
+    gc_root_ptr<Blob> blob = new Blob();
+    blob->node = new Node(7);
+#ifdef __linux__
+    gc_bytes *big = (*buffers)[4];
+    mprotect(big->data(), big->size(), PROT_NONE);
+#endif
+    gc::collect(); // "Deleted:7", nothing reaches the node through the blob
+#ifdef __linux__
+    mprotect(big->data(), big->size(), PROT_READ | PROT_WRITE);
+#endif
+    bool intact = true;
+    for (int i = 0; i < 5; i++)
+        intact &= (*buffers)[i]->size() == lengths[i] && (*buffers)[i]->data()[lengths[i] - 1] == char(i);
+    std::cout << (intact ? "OK" : "KO") << std::endl;
+
+    buffers.reset();
+    blob.reset();
+    gc::collect();
+    std::cout << gc::last_statistics().freed_objects << std::endl; // 7
+}
+
+// reads the configuration from its destructor
+class Reader : public gc_object
+{
+public:
+    ~Reader()
+    {
+        std::cout << "Promotion age:" << gc::configuration().promotion_age << std::endl;
+    }
+};
+
+// configuration() does not stop the world, so a destructor on the finalizer thread may call it while
+// the next collection waits for the finalizer
+void test33()
+{
+    gc::options o = gc::configuration();
+    o.finalizer = true;
+    gc::configure(o);
+    for (int i = 0; i < 3; i++)
+    {
+        new Reader();
+        gc::collect(); // "Promotion age:2" once the finalizer gets to it
+    }
+    gc::collect();
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 2)
@@ -398,6 +1399,114 @@ int main(int argc, char **argv)
         test5();
         break;
 
+    case 7:
+        test7();
+        break;
+
+    case 8:
+        test8();
+        break;
+
+    case 9:
+        test9();
+        break;
+
+    case 10:
+        test10();
+        break;
+
+    case 11:
+        test11();
+        break;
+
+    case 12:
+        test12();
+        break;
+
+    case 13:
+        test13();
+        break;
+
+    case 14:
+        test14();
+        break;
+
+    case 15:
+        test15();
+        break;
+
+    case 16:
+        test16();
+        break;
+
+    case 17:
+        test17();
+        break;
+
+    case 18:
+        test18();
+        break;
+
+    case 19:
+        test19();
+        break;
+
+    case 20:
+        test20();
+        break;
+
+    case 21:
+        test21();
+        break;
+
+    case 22:
+        test22();
+        break;
+
+    case 23:
+        test23();
+        break;
+
+    case 24:
+        test24();
+        break;
+
+    case 25:
+        test25();
+        break;
+
+    case 26:
+        test26();
+        break;
+
+    case 27:
+        test27();
+        break;
+
+    case 28:
+        test28();
+        break;
+
+    case 29:
+        test29();
+        break;
+
+    case 30:
+        test30();
+        break;
+
+    case 31:
+        test31();
+        break;
+
+    case 32:
+        test32();
+        break;
+
+    case 33:
+        test33();
+        break;
+
     case 6:
         #include <chrono>
         using std::chrono::duration;